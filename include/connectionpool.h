@@ -0,0 +1,181 @@
+﻿/**
+ * @file connectionpool.h
+ * @author Haolin Yang
+ * @brief SQLite连接池
+ * @version 0.1
+ * @date 2022-05-16
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note QSqlDatabase的连接只能在创建它的线程中使用. 连接池为每个读线程创建一个只读连接, 写操作使用单独的写连接.
+ * @note 每个连接有自己的已编译语句缓存.
+ */
+
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <functional>
+
+/**
+ * @brief SQLite的持久性与缓存设置, 对应同名的PRAGMA
+ */
+struct SqliteProfile
+{
+    QString name = "durable";      //预设名称
+    QString journalMode = "WAL";   //journal_mode
+    QString synchronous = "FULL";  //synchronous
+    int cacheSize = -2000;         //cache_size, 负数表示KiB
+    qint64 mmapSize = 0;           //mmap_size, 单位字节
+    QString tempStore = "DEFAULT"; //temp_store
+    int pageSize = 4096;           //page_size, 只对新建的数据库生效
+
+    /**
+     * @brief 取得预设的设置
+     * @param name 预设名称: "durable" 每次提交都同步到磁盘; "throughput" 只在检查点同步, 使用更大的缓存和内存映射
+     * @param profile 用于返回结果
+     * @return true 存在该预设
+     * @return false 不存在该预设
+     */
+    static bool preset(const QString &name, SqliteProfile &profile);
+};
+
+/**
+ * @brief 连接池的使用统计
+ */
+struct ConnectionPoolStats
+{
+    int readers;          //当前打开的读连接数
+    int maxReaders;       //读连接数上限
+    qint64 readerOpens;   //累计打开的读连接数
+    qint64 readerReuses;  //复用本线程已有读连接的次数
+    qint64 readerWaits;   //因读连接数达到上限而等待的次数
+    qint64 statementHits; //已编译语句缓存的命中次数
+    qint64 statementMiss; //已编译语句缓存的未命中次数
+};
+
+/**
+ * @brief SQLite连接池
+ */
+class ConnectionPool
+{
+public:
+    ConnectionPool() = delete;
+
+    /**
+     * @brief 构造函数, 打开写连接
+     * @param _name 连接名称, 写连接使用该名称, 读连接在其后加后缀
+     * @param _databaseName 数据库文件
+     * @param _profile SQLite设置
+     * @param _maxReaders 读连接数上限
+     * @note 写连接属于调用构造函数的线程.
+     */
+    ConnectionPool(const QString &_name, const QString &_databaseName, const SqliteProfile &_profile, int _maxReaders);
+
+    /**
+     * @brief 析构函数, 关闭所有连接
+     */
+    ~ConnectionPool();
+
+    /**
+     * @brief 写连接
+     */
+    QSqlDatabase writer() const;
+
+    /**
+     * @brief 当前线程的读连接, 没有时打开一个
+     * @return QSqlDatabase 读连接, 打开失败时为无效的连接, 下次调用时重试
+     * @note 读连接数达到上限时等待其他线程的读连接被关闭.
+     */
+    QSqlDatabase reader();
+
+    /**
+     * @brief 关闭当前线程的读连接
+     * @note QThread结束时自动关闭它的读连接, 不是由QThread启动的线程需要在结束前调用.
+     */
+    void releaseThread();
+
+    /**
+     * @brief 取得写连接上已编译的语句, 不存在时编译并缓存
+     * @param queryString SQL语句, 同时作为缓存的键
+     * @return QSqlQuery& 缓存中的语句, 调用者只需重新绑定参数
+     */
+    QSqlQuery &writerQuery(const QString &queryString);
+
+    /**
+     * @brief 取得当前线程读连接上已编译的语句, 不存在时编译并缓存
+     * @param key 语句形状的键
+     * @param build 缓存未命中时生成SQL语句
+     * @return QSqlQuery& 缓存中的语句, 调用者只需重新绑定参数; 读连接打开失败时为执行必然失败的空语句
+     * @note 同一个键的语句仍在读取结果时(例如在visitor中再次执行同一形状的查询), 另编译一条缓存在它之后, 外层的遍历不受影响.
+     */
+    QSqlQuery &readerQuery(const QString &key, const std::function<QString()> &build);
+
+    /**
+     * @brief 使用统计
+     */
+    ConnectionPoolStats stats() const;
+
+    /**
+     * @brief 对一个连接应用SQLite设置
+     * @param connection 已打开的数据库连接
+     * @param profile SQLite设置
+     * @param writable 是否为可写连接, 只读连接不设置journal_mode和page_size
+     * @param report 是否把实际生效的设置写入日志
+     */
+    static void applyProfile(QSqlDatabase &connection, const SqliteProfile &profile, bool writable, bool report);
+
+private:
+    /**
+     * @brief 一个连接及其已编译语句的缓存
+     */
+    struct PooledConnection
+    {
+        QString connectionName;                       //连接名称
+        QHash<QString, QList<QSqlQuery *>> statements; //已编译的语句, 同一个键按重入的深度各有一条
+        QMetaObject::Connection finished;             //所属线程结束时关闭该连接
+    };
+
+    QString name;                               //连接名称
+    QString databaseName;                       //数据库文件
+    SqliteProfile profile;                      //SQLite设置
+    int maxReaders;                             //读连接数上限
+    PooledConnection writerConnection;          //写连接
+    QHash<QThread *, PooledConnection *> readers; //各线程的读连接
+    int readerSerial;                           //读连接名称的序号
+    mutable QMutex mutex;                       //保护readers和统计
+    QWaitCondition released;                    //有读连接被关闭
+    ConnectionPoolStats counters;               //使用统计
+
+    /**
+     * @brief 在一个连接的缓存中查找或编译语句
+     * @note 返回该键下第一条不在读取结果的语句, 都在读取时编译一条新的.
+     */
+    QSqlQuery &statement(PooledConnection &connection, const QString &key, const std::function<QString()> &build);
+
+    /**
+     * @brief 当前线程的读连接, 没有时打开一个
+     * @return PooledConnection* 读连接, 打开失败时为nullptr, 不占用读连接数
+     */
+    PooledConnection *readerConnection();
+
+    /**
+     * @brief 关闭一个线程的读连接并唤醒等待的线程
+     * @param thread 读连接所属的线程
+     * @note 在该线程中调用.
+     */
+    void release(QThread *thread);
+
+    /**
+     * @brief 关闭一个连接
+     */
+    static void close(PooledConnection *connection);
+};
+
+#endif
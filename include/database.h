@@ -7,7 +7,7 @@
  *
  * @copyright Copyright (c) 2022
  *
- * @note 用户信息使用txt文件存储，快递信息使用sqlite数据库存储。
+ * @note 用户信息默认使用txt文件存储，也可以配置为存储在sqlite数据库的user表中；快递信息使用sqlite数据库存储。
  * @note 对于用户部分, 定义了插入用户(注册), 查询用户, 修改用户密码, 修改用户余额的接口.
  * @note 对于物品部分, 定义了插入物品, 查询物品(根据发送人/接收人/时间/快递单号即id), 修改物品信息, 删除物品的接口.
  */
@@ -18,13 +18,51 @@
 #include <QFile>
 #include <QtSql>
 
+#include "connectionpool.h"
 #include "item.h"
+#include "itemarchive.h"
+#include "itembatch.h"
+#include "itemcolumns.h"
+#include "itemid.h"
+#include "snapshot.h"
 #include "user.h"
+#include "usercommit.h"
+#include "userlog.h"
 
 class Item;
 class Time;
 class User;
 
+const int USER_STORAGE_FILE = 0;   //用户信息存储在用户文件和变更日志中
+const int USER_STORAGE_SQLITE = 1; //用户信息存储在db.sqlite的user表中
+
+/**
+ * @brief 数据库配置
+ * @note 由main从配置文件中读取, 配置文件中没有的项使用这里的默认值.
+ */
+struct DatabaseConfig
+{
+    int userLogCompactThreshold = 1000;   //用户变更日志达到多少条时压缩为新的基文件
+    int userStorage = USER_STORAGE_FILE; //用户信息的存储方式
+    int userCommitInterval = 10;          //用户变更组提交的刷新间隔, 单位毫秒
+    int userCommitBatchSize = 256;        //用户变更组提交的批大小
+    bool userFlushOnAck = true;           //每次用户变更是否等待写入完成后再返回, 写入失败时才能回滚; 只有并发提交时组提交才能合并写入
+    bool bootSnapshot = true;             //是否在退出时写快照并在启动时使用
+    int itemIdBlockSize = 1000;           //物品id每次租用的数量
+    int itemCacheSize = 4096;             //按id缓存的物品数量上限, 由ItemManage使用
+    int archiveAfterDays = 180;           //签收多少天后的物品可以归档
+    bool itemColumnar = false;            //是否用列式快照执行多个条件的查询, 由ItemManage使用
+    SqliteProfile sqlite;                 //SQLite的持久性与缓存设置
+    int sqliteReaders = 4;                //连接池中读连接数的上限
+
+    /**
+     * @brief 从ini配置文件中读取配置
+     * @param fileName 配置文件名
+     * @return DatabaseConfig 读取到的配置, 文件不存在时全部为默认值
+     */
+    static DatabaseConfig load(const QString &fileName);
+};
+
 /**
  * @brief 数据库类
  */
@@ -42,11 +80,29 @@ public:
      * @brief 构造函数
      * @param connectionName 连接名称
      * @param fileName 文件名
+     * @param _config 数据库配置
      *
-     * @note 检查是否存在user、item两个table，如果不存在某个表则创建；同时打开用户名文件，将用户名信息读取到usernameSet中。
+     * @note 检查是否存在user、item两个table，如果不存在某个表则创建，并补齐item表的索引；
+     * @note 文件存储时读取用户文件并重放用户变更日志，将用户信息读取到usernameSet和userIndex中；
+     * @note sqlite存储时若user表是新建的则先从用户文件导入，再将用户名读取到usernameSet中。
+     * @note 快照有效时直接从快照载入用户。载入用户在单独的线程中进行，与打开数据库同时进行。
      *
      */
-    Database(const QString &connectionName, const QString &fileName);
+    Database(const QString &connectionName, const QString &fileName, const DatabaseConfig &_config = DatabaseConfig());
+
+    /**
+     * @brief 析构函数
+     * @note 等待所有已提交的用户变更写入完成, 然后写快速启动快照.
+     */
+    ~Database();
+
+    /**
+     * @brief 从用户文件(及其变更日志)一次性导入用户到user表
+     * @param fileName 用户文件名
+     * @return int 导入的用户数量
+     * @note 在同一个事务中导入，已存在的用户名会被跳过.
+     */
+    int importUsersFromFile(const QString &fileName);
 
     /**
      * @brief 插入用户条目
@@ -58,13 +114,26 @@ public:
      * @param name 姓名
      * @param phoneNumber 电话号码
      * @param address 地址
+     * @return true 插入成功
+     * @return false 用户已存在或写入失败
      */
-    void insertUser(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address);
+    bool insertUser(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address);
+
+    /**
+     * @brief 批量插入用户条目
+     *
+     * @param users 用户名和用户记录的列表
+     * @param failures 用于返回插入失败的条目, 键为该条目在users中的下标, 值为错误信息
+     * @return int 插入成功的数量
+     * @note 先对整批用户名检查usernameSet和批内重复, 再一次提交全部通过检查的用户. 写入失败时整批都记为失败.
+     */
+    int insertUsers(const QList<QPair<QString, UserRecord>> &users, QMap<int, QString> &failures);
 
     /**
      * @brief 根据用户名查询用户是否存在
      * @param targetUsername 用户名
      * @return QSharedPointer<User> 查询到用户则返回指针，否则返回NULL
+     * @note 直接查询内存中的userIndex, 不再扫描用户文件.
      */
     QSharedPointer<User> queryUserByName(const QString &targetUsername) const;
 
@@ -83,7 +152,7 @@ public:
      * @return true 修改成功
      * @return false 修改失败
      */
-    bool modifyUserPassword(const QString &targetUsername, const QString &targetPassword) const;
+    bool modifyUserPassword(const QString &targetUsername, const QString &targetPassword);
 
     /**
      * @brief 修改用户余额
@@ -93,7 +162,17 @@ public:
      * @return true 修改成功
      * @return false 修改失败
      */
-    bool modifyUserBalance(const QString &targetUsername, int targetBalance) const;
+    bool modifyUserBalance(const QString &targetUsername, int targetBalance);
+
+    /**
+     * @brief 同时修改多个用户的余额
+     *
+     * @param balances 用户名到改后余额的映射
+     * @return true 全部修改成功
+     * @return false 有用户不存在或写入失败, 此时不做任何修改
+     * @note 这些修改作为一次提交, 总在同一批中写入.
+     */
+    bool modifyUserBalances(const QMap<QString, int> &balances);
 
     /**
      * @brief 查询表中主键的最大值
@@ -102,6 +181,14 @@ public:
      */
     int getDBMaxId(const QString &tableName) const;
 
+    /**
+     * @brief 分配一段连续的物品id
+     * @param count 数量
+     * @return int 第一个id, 失败时返回-1
+     * @note 可以在多个线程中同时调用, 与其他写同一数据库的进程也不会冲突.
+     */
+    int allocateItemIds(int count);
+
     /**
      * @brief 插入物品
      *
@@ -118,6 +205,17 @@ public:
      */
     void insertItem(int id, int cost, int type, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description);
 
+    /**
+     * @brief 在一个事务中批量插入物品
+     *
+     * @param firstId 第一个物品的主键, 之后的物品依次加一
+     * @param specs 物品信息列表
+     * @return true 全部插入成功
+     * @return false 插入失败, 已全部回滚
+     * @note 复用同一条已编译的插入语句, 整批只提交一次.
+     */
+    bool insertItems(int firstId, const QVector<ItemSpec> &specs);
+
     /**
      * @brief 将文件的User查询结果转换成指向User的指针
      * @param username 用户名
@@ -129,14 +227,22 @@ public:
      * @param address 地址
      * @return QSharedPointer<User> 一个指向新创建的User类的指针
      */
-    QSharedPointer<User> query2User(const QString &username, QString &password, int &type, int &balance, QString &name, QString &phoneNumber, QString &address) const;
+    QSharedPointer<User> query2User(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address) const;
 
     /**
      * @brief 将数据库的Item查询结果转换成指向Item的指针
      * @param sqlQuery Item类的查询结果
+     * @param columns 查询读出的列, 见ITEM_COLUMN_*. 没有读出描述信息时, 描述信息在第一次访问时读取
+     * @return QSharedPointer<Item> 一个指向新创建的Item类的指针
+     */
+    QSharedPointer<Item> query2Item(const QSqlQuery &sqlQuery, const int columns = ITEM_COLUMNS_ALL) const;
+
+    /**
+     * @brief 将归档中的物品转换成指向Item的指针
+     * @param item 归档中的物品
      * @return QSharedPointer<Item> 一个指向新创建的Item类的指针
      */
-    QSharedPointer<Item> query2Item(const QSqlQuery &sqlQuery) const;
+    QSharedPointer<Item> archived2Item(const ArchivedItem &item) const;
 
     /**
      * @brief 查询所有用户
@@ -145,19 +251,153 @@ public:
      */
     int queryAllUser(QList<QSharedPointer<User>> &result);
 
+    /**
+     * @brief 按用户名顺序分页查询用户
+     * @param result 用于返回结果
+     * @param afterUsername 上一页最后一个用户名, 第一页为空串
+     * @param limit 每页数量, 为负数时不限制
+     * @return int 本页的数量
+     */
+    int queryUserPage(QList<QSharedPointer<User>> &result, const QString &afterUsername, int limit);
+
     /**
      * @brief 根据条件查询物品
      * @param result 用于返回结果
-     * @param id 物品单号
-     * @param state 物品状态
-     * @param sendingTime 寄送时间
-     * @param receivingTime 接收时间
-     * @param srcName 寄件用户的用户名
-     * @param dstName 收件用户的用户名
-     * @param expressman
+     * @param filter 查询条件
      * @return int 查到符合条件的数量
+     * @note 日期条件编译为sendingDay、receivingDay上的范围比较, 可以使用索引.
+     */
+    int queryItemByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter) const;
+
+    /**
+     * @brief 根据条件分页查询物品
+     * @param result 用于返回结果
+     * @param filter 查询条件
+     * @param page 分页方式
+     * @param nextCursor 用于返回下一页的游标, 本页不满时为空串
+     * @return int 本页的数量, 游标无效时返回-1
+     * @note 按(sendingDay, id)或id做键集扫描, 翻页的代价与页码无关.
+     */
+    int queryItemByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter, const ItemPage &page, QString &nextCursor) const;
+
+    /**
+     * @brief 根据条件查询物品, 随游标前进逐条交给visitor
+     * @param filter 查询条件
+     * @param page 分页方式
+     * @param visitor 处理每一条结果, 返回false时停止读取
+     * @param nextCursor 用于返回下一页的游标, 本页不满且未提前停止时为空串
+     * @return int 交给visitor的数量, 游标无效时返回-1
+     * @note 不保存结果, 占用的内存与匹配的行数无关.
+     */
+    int visitItemsByFilter(const ItemFilter &filter, const ItemPage &page, const ItemVisitor &visitor, QString &nextCursor) const;
+
+    /**
+     * @brief 根据条件查询物品, 结果写成扁平记录, 每满一批交给visitor
+     * @param filter 查询条件
+     * @param page 分页方式, 未读出的描述信息为空串
+     * @param batch 存放记录的批次, 调用者可以在多次查询间复用
+     * @param visitor 处理每一条记录, 返回false时停止读取
+     * @param nextCursor 用于返回下一页的游标, 本页不满且未提前停止时为空串
+     * @return int 交给visitor的数量, 游标无效时返回-1
+     * @note 不构造Item对象, 每一批的记录和字符串在一块连续的内存中.
+     */
+    int visitItemRecords(const ItemFilter &filter, const ItemPage &page, ItemBatch &batch, const ItemRecordVisitor &visitor, QString &nextCursor) const;
+
+    /**
+     * @brief 按给定的单号批量读出物品, 逐条交给visitor
+     * @param ids 物品单号, 已按page.descending排好序
+     * @param page 分页方式, 只使用读出的列和排序方向
+     * @param visitor 处理每一条结果, 返回false时停止读取
+     * @param nextCursor 提前停止时返回按id排序的游标, 否则为空串
+     * @return int 交给visitor的数量, 失败时返回-1
+     * @note 每条语句用id IN (...)读出一组单号, 已删除的单号被跳过.
+     */
+    int visitItemsByIds(const QVector<int> &ids, const ItemPage &page, const ItemVisitor &visitor, QString &nextCursor) const;
+
+    /**
+     * @brief 按给定的单号批量读出物品, 结果写成扁平记录, 每满一批交给visitor
+     * @param ids 物品单号, 已按page.descending排好序
+     * @param page 分页方式, 只使用读出的列和排序方向
+     * @param batch 存放记录的批次
+     * @param visitor 处理每一条记录, 返回false时停止读取
+     * @param nextCursor 提前停止时返回按id排序的游标, 否则为空串
+     * @return int 交给visitor的数量, 失败时返回-1
+     */
+    int visitItemRecordsByIds(const QVector<int> &ids, const ItemPage &page, ItemBatch &batch, const ItemRecordVisitor &visitor, QString &nextCursor) const;
+
+    /**
+     * @brief 把接收日期早于cutoffDay的已签收物品移到归档
+     * @param cutoffDay 日期键
+     * @return int 归档的物品数量, 失败时返回-1
+     * @note 每批先写归档再从item表删除. 中断时物品可能同时在两处, 下次归档时跳过已归档的id并完成删除.
+     * @note 归档的物品不再出现在统计和全文搜索中.
+     */
+    int archiveItems(const int cutoffDay);
+
+    /**
+     * @brief 把rowid大于columns.lastRowid()的物品追加到列式快照
+     * @param columns 列式快照
+     * @return int 追加的行数, 失败时返回-1
+     */
+    int scanItemColumns(ItemColumns &columns) const;
+
+    /**
+     * @brief 重新读取被修改或删除的物品, 在列式快照中原位更新
+     * @param columns 列式快照
+     * @param ids 被修改或删除的物品单号
+     * @return int 更新的行数, 失败时返回-1
+     * @note 已不在item表中的单号在快照中标记为已删除.
      */
-    int queryItemByFilter(QList<QSharedPointer<Item>> &result, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &expressman, const QString &dstName) const;
+    int refreshItemColumns(ItemColumns &columns, const QVector<int> &ids) const;
+
+    /**
+     * @brief 取出并清空上次调用之后被修改或删除的物品单号
+     */
+    QVector<int> takeChangedItemIds() const;
+
+    /**
+     * @brief 列式快照整体失效的次数
+     * @note 与构建列式快照时不同, 说明记录的单号不完整, 需要整体重建.
+     */
+    qint64 itemChangeSerial() const;
+
+    /**
+     * @brief 在归档中按id查询物品
+     * @param id 物品单号
+     * @param result 用于返回结果
+     * @return true 找到
+     * @return false 不在归档中
+     */
+    bool queryArchivedItem(const int id, QSharedPointer<Item> &result) const;
+
+    /**
+     * @brief 读取一个物品的描述信息
+     * @param id 物品单号
+     * @return QString 描述信息, 物品已被归档时从归档中读取, 不存在时为空串
+     */
+    QString loadItemDescription(const int id) const;
+
+    /**
+     * @brief 按条件统计物品的数量和费用之和
+     * @param filter 查询条件
+     * @param groupBy 分组方式, 见ITEM_GROUP_*
+     * @param result 用于返回每组的统计, 按分组的值升序
+     * @return true 统计成功
+     * @return false 分组方式无效或查询失败
+     * @note 以SQL的COUNT、SUM和GROUP BY完成, 不读出物品.
+     */
+    bool aggregateItems(const ItemFilter &filter, const int groupBy, QVector<ItemAggregate> &result) const;
+
+    /**
+     * @brief 在物品描述中全文搜索, 同时满足查询条件
+     * @param text 搜索词, 以空格分隔的各词须同时出现
+     * @note 短于分词长度的词改用LIKE在候选行上检查; 所有词都很短时按id从新到旧扫描.
+     * @param filter 查询条件
+     * @param limit 最多返回的数量, 不大于0时不限
+     * @param ids 用于返回物品单号, 按相关度(bm25)从高到低
+     * @return int 返回的数量, 全文索引不可用或查询失败时返回-1
+     */
+    int searchItems(const QString &text, const ItemFilter &filter, const int limit, QVector<int> &ids) const;
 
     /**
      * @brief 修改物品状态
@@ -177,6 +417,18 @@ public:
      */
     bool modifyItemExpressman(const int id, const QString &expressman);
 
+    /**
+     * @brief 用一条带状态检查的UPDATE语句完成物品的状态转换
+     * @param id 物品单号
+     * @param expectedState 预期的当前状态
+     * @param state 新状态
+     * @param receivingTime 新的接收时间, 年为-1时不修改
+     * @param expressman 新的快递员, 空串时不修改
+     * @return true 有一行被修改
+     * @return false 物品不存在、当前状态不是expectedState或执行失败
+     */
+    bool transitionItem(const int id, const int expectedState, const int state, const Time &receivingTime, const QString &expressman);
+
     /**
      * @brief 修改物品接收时间
      * @param id 物品单号
@@ -200,11 +452,139 @@ public:
      * @return true 删除成功
      * @return false 删除失败
      */
-    bool deleteUser(const QString username) const;
+    bool deleteUser(const QString username);
 
 private:
-    QSqlDatabase db;      // SQLite数据库
-    QString userFileName; //永久存储用户信息文件
+    QSqlDatabase db;                      // SQLite数据库的写连接, 由连接池持有
+    QString userFileName;                 //永久存储用户信息文件
+    DatabaseConfig config;                //数据库配置
+    QHash<QString, UserRecord> userIndex; //用户名到用户记录的索引, 与用户文件保持同步
+    UserLog userLog;                      //用户文件和用户变更日志
+    QScopedPointer<UserCommitQueue> userCommit; //用户变更的组提交队列
+    QString snapshotFileName;             //快速启动快照
+    QScopedPointer<ItemIdAllocator> itemIds; //物品id的分配器
+    bool itemSearchAvailable;             //物品描述的全文索引是否可用
+    int itemSearchMinTerm;                //全文索引能匹配的最短词长, trigram分词为3
+    ItemArchive archive;                  //已签收物品的冷归档
+    mutable QAtomicInteger<qint64> itemChanges; //列式快照整体失效的次数
+    mutable QMutex changedItemsMutex;     //保护changedItems
+    mutable QSet<int> changedItems;       //提交后被修改或删除、列式快照尚未更新的物品单号
+    QScopedPointer<ConnectionPool> pool;  //写连接和各线程的读连接
+
+    /**
+     * @brief 创建一个item表结构的表
+     * @param tableName 表名
+     * @return true 创建成功
+     * @return false 创建失败
+     * @note 日期以日期键(见Time::toDayKey)存储在sendingDay、receivingDay两列中.
+     */
+    bool createItemTable(const QString &tableName);
+
+    /**
+     * @brief 把旧的按年、月、日分列存储日期的item表迁移为日期键
+     * @note 分批复制到item_migrating表, 每批一个事务, 中断后下次打开时继续; 全部复制后替换旧表.
+     */
+    void migrateItemDates();
+
+    /**
+     * @brief 为item表创建与查询路径对应的索引
+     * @note 每次打开数据库时调用, 已有的索引会被跳过, 旧数据库据此升级.
+     */
+    void createItemIndexes();
+
+    /**
+     * @brief 在当前线程的读连接上执行按条件查询物品的语句
+     * @param filter 查询条件
+     * @param page 分页方式
+     * @param columns 用于返回实际读出的列
+     * @param status 用于返回状态: 1成功, 0执行失败, -1游标无效
+     * @return QSqlQuery* 已执行的缓存语句, 读完后须调用finish; 失败时为nullptr
+     */
+    QSqlQuery *execItemFilter(const ItemFilter &filter, const ItemPage &page, int &columns, int &status) const;
+
+    /**
+     * @brief 在当前线程的读连接上执行按一组单号查询物品的语句
+     * @param ids 物品单号
+     * @param begin 本组第一个单号的下标, 本组最多ITEM_ID_BATCH个
+     * @param page 分页方式, 只使用读出的列和排序方向
+     * @param columns 用于返回实际读出的列, 总包含寄送日期
+     * @return QSqlQuery* 已执行的缓存语句, 读完后须调用finish; 失败时为nullptr
+     */
+    QSqlQuery *execItemIds(const QVector<int> &ids, const int begin, const ItemPage &page, int &columns) const;
+
+    /**
+     * @brief 记录一个提交后被修改或删除的物品, 供列式快照原位更新
+     * @param id 物品单号
+     */
+    void markItemChanged(const int id) const;
+
+    /**
+     * @brief 建立物品描述的FTS5全文索引item_fts, 并用触发器随item表的插入和删除维护
+     * @return true 全文索引可用
+     * @return false SQLite不支持FTS5, 搜索不可用
+     * @note 索引是新建的时从item表回填. 优先使用trigram分词, 使中文描述可以按子串搜索.
+     */
+    bool createItemSearchIndex();
+
+    /**
+     * @brief 快照依赖的文件
+     */
+    QStringList snapshotWatchedFiles() const;
+
+    /**
+     * @brief 载入用户, 在启动线程中执行
+     * @param snapshot 快照, 有效时直接使用
+     * @return true 载入成功
+     * @return false 用户文件无法打开
+     * @note sqlite存储且快照无效时不做任何事, 由构造函数在数据库打开后读取.
+     */
+    bool loadUsers(const BootSnapshot *snapshot);
+
+    /**
+     * @brief 查询一个用户的记录
+     * @param username 用户名
+     * @param record 用于返回结果
+     * @return true 存在该用户
+     * @return false 不存在该用户
+     */
+    bool queryUserRecord(const QString &username, UserRecord &record) const;
+
+    /**
+     * @brief 提交一组用户变更, 并更新usernameSet和文件存储时的userIndex
+     * @param changes 用户变更列表
+     * @return true 提交成功, user/flushOnAck为true时表示已写入
+     * @return false 写入失败, usernameSet和userIndex已恢复为提交前的状态
+     * @note 文件存储时日志达到阈值则在后台压缩. flushOnAck为false时写入在后台进行, 失败只记录日志.
+     */
+    bool commitUsers(const QList<UserChange> &changes);
+
+    /**
+     * @brief 在一个事务中把一批用户变更写入user表
+     * @param connection 写线程的数据库连接
+     * @param changes 用户变更列表
+     * @return true 写入成功
+     * @return false 写入失败, 已回滚
+     */
+    static bool writeUserChanges(QSqlDatabase &connection, const QList<UserChange> &changes);
+
+    /**
+     * @brief 推进item_id表中的高水位, 租用一段物品id
+     * @param connectionName 连接名称的前缀
+     * @param count 数量
+     * @param first 用于返回第一个id
+     * @return true 租用成功
+     * @return false 租用失败, 已回滚
+     * @note 使用调用线程临时打开的连接, 高水位不低于item表中的最大id.
+     */
+    static bool leaseItemIds(const QString &connectionName, int count, int &first);
+
+    /**
+     * @brief 高水位仍是last时把它退回到next之前
+     * @param connectionName 连接名称的前缀
+     * @param next 第一个未使用的id
+     * @param last 段中的最后一个id
+     */
+    static void giveBackItemIds(const QString &connectionName, int next, int last);
 
     /**
      * @brief 执行SQL语句
@@ -17,8 +17,15 @@
 
 #define DEBUG
 
+#include <QCache>
+#include <QMutex>
 #include <QSharedPointer>
+#include <QVariant>
 #include <QDebug>
+#include <QVector>
+#include <functional>
+#include <mutex>
+#include "symbol.h"
 #include "time.h"
 
 const int PENDING_COLLECTING = 1; //待揽收
@@ -34,6 +41,9 @@ const int BOOK_PRICE = 2;         //图书单价
 const int NORMAL_ITEM_PRICE = 5;  //普通快递单价
 
 class Database;
+class ItemBatch;
+class ItemColumns;
+struct ItemRecord;
 class Time;
 
 /**
@@ -61,7 +71,7 @@ public:
      * @param _description 物品描述
      * @note 注意是否使用std::move
      */
-    Item(int _id, int _cost, int _state, Time _sendingTime, Time _receivingTime, QString _srcName, QString _dstName, QString _expressman, QString _description) : id(_id), cost(_cost), state(_state), sendingTime(_sendingTime), receivingTime(_receivingTime), srcName(_srcName), dstName(_dstName), expressman(_expressman), description(_description)
+    Item(int _id, int _cost, int _state, Time _sendingTime, Time _receivingTime, QString _srcName, QString _dstName, QString _expressman, QString _description) : id(_id), cost(_cost), state(_state), sendingTime(_sendingTime), receivingTime(_receivingTime), srcName(internSymbol(_srcName)), dstName(internSymbol(_dstName)), expressman(internSymbol(_expressman)), description(_description)
     {
 #ifdef DEBUG
         qDebug() << "构造item";
@@ -121,25 +131,56 @@ public:
      * @brief 获得寄件用户的用户名
      * @return const QString& 寄件用户的用户名
      */
-    const QString &getSrcName() const { return srcName; }
+    const QString &getSrcName() const { return symbolName(srcName); }
+
+    /**
+     * @brief 获得寄件用户的用户名符号
+     * @return int 用户名符号, 见SymbolTable
+     */
+    int getSrcSymbol() const { return srcName; }
 
     /**
      * @brief 获得收件用户的用户名
      * @return const QString& 收件用户的用户名
      */
-    const QString &getDstName() const { return dstName; }
+    const QString &getDstName() const { return symbolName(dstName); }
+
+    /**
+     * @brief 获得收件用户的用户名符号
+     * @return int 用户名符号, 见SymbolTable
+     */
+    int getDstSymbol() const { return dstName; }
 
     /**
      * @brief 获得快递员的用户名
      * @return const QString& 快递员的用户名
      */
-    const QString &getExpressman() const { return expressman; }
+    const QString &getExpressman() const { return symbolName(expressman); }
+
+    /**
+     * @brief 获得快递员的用户名符号
+     * @return int 用户名符号, 见SymbolTable
+     */
+    int getExpressmanSymbol() const { return expressman; }
 
     /**
      * @brief 获得描述信息
      * @return const QString& 描述信息
+     * @note 查询时没有读出描述信息的物品在第一次访问时才读取.
+     */
+    const QString &getDescription() const
+    {
+        if (descriptionLoader)
+            std::call_once(descriptionLoaded, [this]()
+                           { description = descriptionLoader(id); });
+        return description;
+    }
+
+    /**
+     * @brief 设置描述信息的读取函数, 用于查询时没有读出描述信息的物品
+     * @param loader 按物品单号读取描述信息
      */
-    const QString &getDescription() const { return description; }
+    void setDescriptionLoader(const std::function<QString(int)> &loader) { descriptionLoader = loader; }
 
     /**
      * @brief 插入快递信息到数据库中
@@ -154,10 +195,14 @@ protected:
     int state;           //物品状态
     Time sendingTime;    //寄送时间
     Time receivingTime;  //接收时间
-    QString srcName;     //寄件用户的用户名
-    QString dstName;     //收件用户的用户名
-    QString expressman;  //快递员
-    QString description; //物品描述
+    int srcName;         //寄件用户的用户名符号
+    int dstName;         //收件用户的用户名符号
+    int expressman;      //快递员的用户名符号
+    mutable QString description; //物品描述
+
+private:
+    std::function<QString(int)> descriptionLoader; //描述信息的读取函数, 为空时描述信息已在description中
+    mutable std::once_flag descriptionLoaded;      //描述信息只读取一次, 缓存中的物品可能被多个线程同时访问
 };
 
 //易碎品类
@@ -262,8 +307,142 @@ public:
     virtual int getPrice() const override { return NORMAL_ITEM_PRICE; };
 };
 
+/**
+ * @brief 物品查询条件
+ * @note 整数条件为-1、字符串条件为空时表示不限制.
+ * @note 日期条件为闭区间的日期键(见Time::toDayKey), 只给出一端时为单侧范围.
+ */
+struct ItemFilter
+{
+    int id = -1;            //物品单号
+    int state = -1;         //物品状态
+    int sendingFrom = -1;   //寄送日期不早于
+    int sendingTo = -1;     //寄送日期不晚于
+    int receivingFrom = -1; //接收日期不早于
+    int receivingTo = -1;   //接收日期不晚于
+    int sendingMonth = -1;    //寄送月份, 用于不给出年的查询, 不能使用索引
+    int sendingMonthDay = -1; //寄送日(一月中的第几天), 用于不给出年或月的查询, 不能使用索引
+    int receivingMonth = -1;    //接收月份, 同sendingMonth
+    int receivingMonthDay = -1; //接收日, 同sendingMonthDay
+    QString srcName;        //寄件用户的用户名
+    QString dstName;        //收件用户的用户名
+    QString expressman;     //快递员的用户名
+    bool includeArchived = false; //不分页时是否接着查询归档
+};
+
+/**
+ * @brief 批量插入时一个物品的信息, id由ItemManage统一分配
+ */
+struct ItemSpec
+{
+    int cost;            //快递花费
+    int state;           //物品状态
+    int type;            //物品类型
+    Time sendingTime;    //寄送时间
+    Time receivingTime;  //接收时间
+    QString srcName;     //寄件用户的用户名
+    QString dstName;     //收件用户的用户名
+    QString expressman;  //快递员的用户名
+    QString description; //物品描述
+};
+
+/**
+ * @brief 逐条接收查询结果的回调
+ * @note 返回false时立即停止查询, 之后的行不再读取.
+ */
+using ItemVisitor = std::function<bool(const QSharedPointer<Item> &)>;
+
+/**
+ * @brief 逐条处理批量查询结果中的记录, 返回false时停止
+ * @note 记录和其中的字符串只在visitor返回前有效.
+ */
+using ItemRecordVisitor = std::function<bool(const ItemBatch &, const ItemRecord &)>;
+
+const int ITEM_ORDER_ID = 0;          //按物品单号排序
+const int ITEM_ORDER_SENDING_DAY = 1; //按寄送日期排序, 同一天内按物品单号
+
+//查询时可选的列, 单号、种类和状态总是读出. 没有读出的列取默认值, 描述信息在第一次访问时读取
+const int ITEM_COLUMN_COST = 1 << 0;           //总花费
+const int ITEM_COLUMN_SENDING_DAY = 1 << 1;    //寄送时间
+const int ITEM_COLUMN_RECEIVING_DAY = 1 << 2;  //接收时间
+const int ITEM_COLUMN_SRC_NAME = 1 << 3;       //寄件用户
+const int ITEM_COLUMN_DST_NAME = 1 << 4;       //收件用户
+const int ITEM_COLUMN_EXPRESSMAN = 1 << 5;     //快递员
+const int ITEM_COLUMN_DESCRIPTION = 1 << 6;    //物品描述
+const int ITEM_COLUMNS_ALL = (1 << 7) - 1;     //全部列
+
+/**
+ * @brief 物品查询的分页方式
+ * @note 分页使用键集扫描: 游标记录上一页最后一个物品的排序键, 下一页从它之后开始, 不使用OFFSET.
+ */
+struct ItemPage
+{
+    int limit = -1;            //每页数量, -1为不分页
+    int orderBy = ITEM_ORDER_ID; //排序方式
+    bool descending = false;   //是否降序
+    QString cursor;            //上一页返回的游标, 空串为第一页
+    int columns = ITEM_COLUMNS_ALL; //需要读出的列, 见ITEM_COLUMN_*
+
+    /**
+     * @brief 生成指向某个物品之后的游标
+     * @param day 该物品的寄送日期键
+     * @param id 该物品的单号
+     * @return QString 不透明的游标
+     */
+    QString encodeCursor(int day, int id) const;
+
+    /**
+     * @brief 解析游标
+     * @param day 用于返回寄送日期键
+     * @param id 用于返回物品单号
+     * @return true 游标有效且与当前排序方式一致
+     * @return false 游标无效
+     */
+    bool decodeCursor(int &day, int &id) const;
+};
+
+const int ITEM_GROUP_NONE = 0;          //不分组, 统计全部
+const int ITEM_GROUP_STATE = 1;         //按物品状态分组
+const int ITEM_GROUP_TYPE = 2;          //按物品类型分组
+const int ITEM_GROUP_EXPRESSMAN = 3;    //按快递员分组
+const int ITEM_GROUP_SENDING_DAY = 4;   //按寄送日期分组
+const int ITEM_GROUP_RECEIVING_DAY = 5; //按接收日期分组
+
+/**
+ * @brief 一组物品的统计
+ */
+struct ItemAggregate
+{
+    QVariant key;   //分组的值, 日期分组时为日期键, 不分组时无意义
+    qint64 count;   //物品数量
+    qint64 costSum; //费用之和
+};
+
+/**
+ * @brief 批量查询结果的累计统计
+ */
+struct ItemBatchStats
+{
+    qint64 batches;     //交给visitor的批数
+    qint64 rows;        //行数
+    qint64 bytes;       //记录和字符实际占用的字节数
+    qint64 allocations; //批次的内存分配次数
+};
+
+/**
+ * @brief 按id缓存物品的命中统计
+ */
+struct ItemCacheStats
+{
+    qint64 hits;   //命中次数
+    qint64 misses; //未命中次数
+    int size;      //当前缓存的物品数
+    int capacity;  //缓存容量
+};
+
 /**
  * @brief 物品管理类
+ * @note 按id查询的结果放在有界的LRU缓存中, 修改和删除物品时使对应的缓存失效.
  */
 class ItemManage
 {
@@ -277,8 +456,16 @@ public:
     /**
      * @brief 构造函数
      * @param _db 数据库的指针
+     * @param cacheCapacity 按id缓存的物品数量上限
+     * @param _columnar 是否用列式快照执行多个条件的不分页查询
+     */
+    ItemManage(Database *_db, int cacheCapacity = 4096, bool _columnar = false);
+
+    /**
+     * @brief 析构函数
+     * @note 输出缓存的命中统计, 释放列式快照.
      */
-    ItemManage(Database *_db);
+    ~ItemManage();
 
     /**
      * @brief 插入一个Item，会自动分配id.
@@ -291,7 +478,7 @@ public:
      * @param srcName 寄件用户的用户名
      * @param dstName 收件用户的用户名
      * @param description 物品描述
-     * @return int 为添加的快递分配的单号
+     * @return int 为添加的快递分配的单号, 分配失败时返回-1
      */
     int insertItem(
         const int cost,
@@ -304,6 +491,15 @@ public:
         const QString &expressman,
         const QString &description);
 
+    /**
+     * @brief 批量插入物品, 分配一段连续的id
+     *
+     * @param specs 物品信息列表
+     * @return int 第一个物品的单号, 第i个物品的单号为返回值+i; 失败时返回-1, 不插入任何物品
+     * @note 所有物品在同一个事务中插入. 插入失败时已分配的id不再使用.
+     */
+    int insertItems(const QVector<ItemSpec> &specs);
+
     /**
      * @brief 查询所有物品
      * @param result 用于返回结果
@@ -314,16 +510,78 @@ public:
     /**
      * @brief 根据条件查询物品
      * @param result 用于返回结果
-     * @param id 物品单号
-     * @param state 物品状态
-     * @param sendingTime 寄送时间
-     * @param receivingTime 接收时间
-     * @param srcName 寄件用户的用户名
-     * @param dstName 收件用户的用户名
-     * @param expressman 快递员的用户名
+     * @param filter 查询条件, 日期可以是范围
      * @return int 查到符合条件的数量
      */
-    int queryByFilter(QList<QSharedPointer<Item>> &result, const int id = -1, const int state = -1, const Time &sendingTime = Time(-1, -1, -1), const Time &receivingTime = Time(-1, -1, -1), const QString &srcName = "", const QString &dstName = "", const QString &expressman = "") const;
+    int queryByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter) const;
+
+    /**
+     * @brief 根据条件查询物品, 只读出需要的列
+     * @param result 用于返回结果
+     * @param filter 查询条件, 日期可以是范围
+     * @param columns 需要读出的列, 见ITEM_COLUMN_*
+     * @return int 查到符合条件的数量
+     */
+    int queryByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter, const int columns) const;
+
+    /**
+     * @brief 根据条件分页查询物品
+     * @param result 用于返回结果
+     * @param filter 查询条件
+     * @param page 分页方式
+     * @param nextCursor 用于返回下一页的游标, 没有下一页时为空串
+     * @return int 本页的数量, 游标无效时返回-1
+     */
+    int queryByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter, const ItemPage &page, QString &nextCursor) const;
+
+    /**
+     * @brief 根据条件查询物品, 逐条交给visitor而不保存结果
+     * @param filter 查询条件
+     * @param page 分页方式
+     * @param visitor 处理每一条结果, 返回false时提前停止
+     * @param nextCursor 用于返回下一页的游标, 提前停止时指向最后处理的一条之后
+     * @return int 处理的数量, 游标无效时返回-1
+     * @note 启用列式快照时, 两个以上条件的不分页查询先在快照上过滤, 只从数据库读出匹配的行.
+     */
+    int visitByFilter(const ItemFilter &filter, const ItemPage &page, const ItemVisitor &visitor, QString &nextCursor) const;
+
+    /**
+     * @brief 根据条件查询物品, 逐条交给visitor扁平记录, 不构造Item对象
+     * @param filter 查询条件
+     * @param page 分页方式
+     * @param visitor 处理每一条记录, 返回false时提前停止
+     * @param nextCursor 用于返回下一页的游标, 提前停止时指向最后处理的一条之后
+     * @return int 处理的数量, 游标无效时返回-1
+     * @note 每行占用的字节数和分配次数计入batchStats.
+     */
+    int visitRecords(const ItemFilter &filter, const ItemPage &page, const ItemRecordVisitor &visitor, QString &nextCursor) const;
+
+    /**
+     * @brief 按条件统计物品的数量和费用之和
+     * @param filter 查询条件
+     * @param groupBy 分组方式, 见ITEM_GROUP_*
+     * @param result 用于返回每组的统计
+     * @return true 统计成功
+     * @return false 统计失败
+     */
+    bool aggregate(const ItemFilter &filter, const int groupBy, QVector<ItemAggregate> &result) const;
+
+    /**
+     * @brief 在物品描述中全文搜索, 同时满足查询条件
+     * @param text 搜索词, 以空格分隔的各词须同时出现
+     * @param filter 查询条件
+     * @param limit 最多返回的数量, 不大于0时不限
+     * @param ids 用于返回物品单号, 按相关度从高到低
+     * @return int 返回的数量, 搜索不可用时返回-1
+     */
+    int search(const QString &text, const ItemFilter &filter, const int limit, QVector<int> &ids) const;
+
+    /**
+     * @brief 把接收日期早于cutoffDay的已签收物品移到归档
+     * @param cutoffDay 日期键
+     * @return int 归档的物品数量, 失败时返回-1
+     */
+    int archive(const int cutoffDay);
 
     /**
      * @brief 根据条件查询物品
@@ -331,8 +589,22 @@ public:
      * @param id 物品单号
      * @return true 存在该物品
      * @return false 不存在该物品
+     * @param includeArchived item表中没有时是否查询归档
+     * @note 先查缓存, 未命中时查询数据库并放入缓存. 缓存只保存item表中的物品, 归档中的物品每次都从归档读取.
      */
-    bool queryById(QSharedPointer<Item> &result, const int id) const;
+    bool queryById(QSharedPointer<Item> &result, const int id, const bool includeArchived = false) const;
+
+    /**
+     * @brief 在物品仍处于预期状态时, 一次修改状态以及接收时间、快递员
+     * @param id 物品单号
+     * @param expectedState 预期的当前状态
+     * @param state 新状态
+     * @param receivingTime 新的接收时间, 年为-1时不修改
+     * @param expressman 新的快递员, 空串时不修改
+     * @return true 状态转换成功
+     * @return false 物品不存在或当前状态不是expectedState, 此时不做任何修改
+     */
+    bool transition(const int id, const int expectedState, const int state, const Time &receivingTime = Time(-1, -1, -1), const QString &expressman = "");
 
     /**
      * @brief 修改物品状态
@@ -370,8 +642,41 @@ public:
      */
     bool deleteItem(const int id) const;
 
+    /**
+     * @brief 按id缓存的命中统计
+     */
+    ItemCacheStats cacheStats() const;
+
+    /**
+     * @brief 批量查询的累计统计
+     */
+    ItemBatchStats batchStats() const;
+
+    /**
+     * @brief 在列式快照上按条件过滤, 过滤前增量刷新快照
+     * @param filter 查询条件, 不支持includeArchived
+     * @param ids 用于返回满足条件的物品单号, 升序
+     * @return int 满足条件的数量, 未启用列式快照时返回-1
+     */
+    int filterColumns(const ItemFilter &filter, QVector<int> &ids) const;
+
 private:
-    Database *db; //数据库
-    int total;    //物品ID允许的最大值
+    Database *db;                                        //数据库
+    mutable QCache<int, QSharedPointer<Item>> itemCache; //按id缓存的物品
+    mutable ItemCacheStats cacheCounters;                //缓存的命中统计
+    mutable QMutex cacheMutex;                           //保护itemCache、cacheCounters和cacheGeneration
+    mutable qint64 cacheGeneration;                      //缓存失效的次数, 未命中后读到的行只在期间没有失效时放入缓存
+    mutable ItemBatchStats batchCounters;                //批量查询的累计统计
+    mutable QMutex batchMutex;                           //保护batchCounters
+    bool columnar;                                       //是否启用列式快照
+    mutable ItemColumns *columns;                        //列式快照, 第一次使用时构建
+    mutable qint64 columnsSerial;                        //构建快照时数据库中快照整体失效的次数
+    mutable QMutex columnsMutex;                         //保护columns
+
+    /**
+     * @brief 使一个物品的缓存失效
+     * @param id 物品单号
+     */
+    void invalidate(const int id) const;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,139 @@
+﻿/**
+ * @file itemarchive.h
+ * @author Haolin Yang
+ * @brief 已签收物品的冷归档
+ * @version 0.1
+ * @date 2022-05-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 签收已久的物品从item表移到归档目录中, 按接收月份分段, 每段是只追加的文件, 由若干qCompress压缩的块组成.
+ * @note 另有一个只追加的索引文件记录每个id所在的段和块, 启动时整个读入内存.
+ * @note 同一个id被归档多次(例如移出item表之前中断)时以索引中最后一条为准, 扫描时跳过其他位置上的副本.
+ */
+
+#ifndef ITEMARCHIVE_H
+#define ITEMARCHIVE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <functional>
+
+#include "item.h"
+
+/**
+ * @brief 归档中的一个物品, 字段与item表的列一一对应
+ */
+struct ArchivedItem
+{
+    int id;               //物品单号
+    int cost;             //快递花费
+    int type;             //物品类型
+    int state;            //物品状态
+    int sendingDay;       //寄送日期键
+    int receivingDay;     //接收日期键
+    QString srcName;      //寄件用户的用户名
+    QString dstName;      //收件用户的用户名
+    QString expressman;   //快递员的用户名
+    QString description;  //物品描述
+};
+
+/**
+ * @brief 已签收物品的冷归档
+ */
+class ItemArchive
+{
+public:
+    ItemArchive() = delete;
+
+    /**
+     * @brief 构造函数
+     * @param _dirName 归档目录, 不存在时在第一次写入时创建
+     */
+    ItemArchive(const QString &_dirName);
+
+    /**
+     * @brief 读入id索引
+     * @return int 已归档的物品数量
+     * @note 索引尾部写到一半的记录被忽略.
+     */
+    int load();
+
+    /**
+     * @brief 追加一批物品
+     * @param items 物品列表, 已在归档中的id被跳过
+     * @return true 写入成功
+     * @return false 写入失败, 已写入的块不在索引中, 不会被读到
+     * @note 先写段文件再写索引, 按接收月份分段, 每段每次追加一个块.
+     * @note 返回true前段文件和索引都已同步到磁盘, 新建文件时还同步了目录, 调用者之后才能删除源数据.
+     */
+    bool append(const QVector<ArchivedItem> &items);
+
+    /**
+     * @brief 按id查找归档的物品
+     * @param id 物品单号
+     * @param result 用于返回结果
+     * @return true 找到
+     * @return false 不在归档中或读取失败
+     * @note 只读出该物品所在的一个块.
+     */
+    bool find(int id, ArchivedItem &result) const;
+
+    /**
+     * @brief 按条件逐条扫描归档的物品
+     * @param filter 查询条件, 接收日期的范围用于跳过整段
+     * @param visitor 处理每一条结果, 返回false时停止
+     * @return int 交给visitor的数量
+     * @note 按段的月份、段内的写入顺序扫描. 用于审计, 代价与归档的大小成正比.
+     */
+    int scan(const ItemFilter &filter, const std::function<bool(const ArchivedItem &)> &visitor) const;
+
+    /**
+     * @brief 是否包含该id
+     */
+    bool contains(int id) const;
+
+    /**
+     * @brief 已归档的物品数量
+     */
+    int size() const;
+
+private:
+    /**
+     * @brief 物品在归档中的位置
+     */
+    struct Location
+    {
+        qint32 month;  //段的月份, 年*100+月
+        qint64 offset; //块在段文件中的偏移
+    };
+
+    QString dirName;                 //归档目录
+    QHash<int, Location> index;      //id到位置的索引
+    mutable QMutex mutex;            //保护index和文件的追加
+
+    /**
+     * @brief 段文件名
+     */
+    QString segmentFileName(int month) const;
+
+    /**
+     * @brief 读出一个块
+     * @param month 段的月份
+     * @param offset 块的偏移
+     * @param items 用于返回块中的物品
+     * @param next 用于返回下一个块的偏移
+     * @return true 读取成功
+     * @return false 文件损坏或已到段尾
+     */
+    bool readBlock(int month, qint64 offset, QVector<ArchivedItem> &items, qint64 *next = nullptr) const;
+
+    /**
+     * @brief 物品是否满足查询条件
+     */
+    static bool matches(const ItemFilter &filter, const ArchivedItem &item);
+};
+
+#endif
@@ -0,0 +1,127 @@
+﻿/**
+ * @file itembatch.h
+ * @author Haolin Yang
+ * @brief 扁平的物品记录和批量查询结果
+ * @version 0.1
+ * @date 2022-05-21
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 逐行构造Item对象要为每一行分配对象、引用计数和四个QString. 批量查询把每一行写成不含虚函数的定长记录,
+ * @note 用户名保存为符号(见SymbolTable), 描述信息拷贝到批次的字符区中, 记录里只保存偏移和长度. 一个批次的内存随批次一起释放, 清空后容量保留给下一批复用.
+ */
+
+#ifndef ITEMBATCH_H
+#define ITEMBATCH_H
+
+#include <QString>
+#include <QVector>
+#include <type_traits>
+
+#include "item.h"
+
+const int ITEM_BATCH_ROWS = 1024;                     //每批最多的行数, 满了之后交给visitor并清空
+const int ITEM_BATCH_TEXT_PER_ROW = 32;               //预留的每行字符数
+const int ITEM_TARGET_BYTES_PER_ROW = 128;            //每行占用字节数的目标, 含字符区
+const double ITEM_TARGET_ALLOCATIONS_PER_ROW = 0.01;  //每行分配次数的目标
+
+//各种物品的单价, 下标为物品种类
+constexpr int ITEM_PRICES[] = {0, FRAGILE_ITEM_PRICE, BOOK_PRICE, NORMAL_ITEM_PRICE};
+
+/**
+ * @brief 物品的单价
+ * @param type 物品种类
+ * @return int 单价, 未知种类为0
+ */
+constexpr int itemPrice(int type)
+{
+    return type >= FRAGILE && type <= NORMAL ? ITEM_PRICES[type] : 0;
+}
+
+/**
+ * @brief 字符串字段在批次字符区中的位置
+ */
+struct ItemText
+{
+    qint32 offset; //起始下标
+    qint32 length; //字符数
+};
+
+/**
+ * @brief 扁平的物品记录
+ */
+struct ItemRecord
+{
+    qint32 id;           //物品单号
+    qint32 cost;         //总花费
+    qint16 type;         //物品种类
+    qint16 state;        //物品状态
+    qint32 sendingDay;   //寄送时间的日期键
+    qint32 receivingDay; //接收时间的日期键
+    qint32 srcName;       //寄件用户的用户名符号
+    qint32 dstName;       //收件用户的用户名符号
+    qint32 expressman;    //快递员的用户名符号
+    ItemText description; //物品描述
+
+    /**
+     * @brief 物品单价, 查编译期的单价表
+     */
+    int price() const { return itemPrice(type); }
+};
+
+static_assert(std::is_trivial<ItemRecord>::value, "ItemRecord必须是平凡类型");
+static_assert(sizeof(ItemRecord) <= 40, "ItemRecord应保持紧凑");
+
+/**
+ * @brief 一批物品记录
+ */
+class ItemBatch
+{
+public:
+    /**
+     * @brief 构造函数, 一次预留一整批的记录和字符区
+     */
+    ItemBatch();
+
+    /**
+     * @brief 追加一行, 用户名转换为符号, 描述信息拷贝到字符区
+     * @return ItemRecord& 新追加的记录
+     */
+    ItemRecord &append(int id, int cost, int type, int state, int sendingDay, int receivingDay,
+                       const QString &srcName, const QString &dstName, const QString &expressman, const QString &description);
+
+    /**
+     * @brief 取得字符串字段
+     * @param text 字段的位置
+     * @return QString 不拷贝字符的QString, 只在批次被清空前有效
+     */
+    QString text(const ItemText &text) const { return QString::fromRawData(texts.constData() + text.offset, text.length); }
+
+    int size() const { return records.size(); }
+    bool isEmpty() const { return records.isEmpty(); }
+    bool isFull() const { return records.size() >= ITEM_BATCH_ROWS; }
+    const ItemRecord &at(int i) const { return records.at(i); }
+
+    /**
+     * @brief 清空记录和字符区, 保留已分配的容量
+     * @note 清空前把本批计入统计.
+     */
+    void clear();
+
+    /**
+     * @brief 累计统计, 包括尚未清空的一批
+     */
+    ItemBatchStats stats() const;
+
+private:
+    QVector<ItemRecord> records; //记录
+    QVector<QChar> texts;        //字符区
+    ItemBatchStats counters;     //已清空的各批的统计
+
+    /**
+     * @brief 把字符串拷贝到字符区
+     */
+    ItemText addText(const QString &value);
+};
+
+#endif
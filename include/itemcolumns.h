@@ -0,0 +1,105 @@
+﻿/**
+ * @file itemcolumns.h
+ * @author Haolin Yang
+ * @brief 物品表的列式内存快照
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 每一列是一个连续的32位整数数组, 用户名保存为符号(见SymbolTable). 过滤时每个条件都化为一列上的闭区间,
+ * @note 按块分给线程池, 每块内逐列用SSE2一次比较16行, 得到每行是否满足全部条件.
+ * @note 快照按item表的rowid增量追加新插入的行; 被修改或删除的物品按单号在原位更新或标记为已删除.
+ * @note item表的id不是rowid的别名, 删除rowid最大的行后SQLite会重用它的rowid, 因此删除末尾的行时扫描起点随之回退.
+ */
+
+#ifndef ITEMCOLUMNS_H
+#define ITEMCOLUMNS_H
+
+#include <QHash>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+#include "item.h"
+
+/**
+ * @brief 物品表的列式内存快照
+ */
+class ItemColumns
+{
+public:
+    ItemColumns();
+
+    /**
+     * @brief 清空快照
+     */
+    void clear();
+
+    /**
+     * @brief 追加一行
+     * @param rowid 该行在item表中的rowid, 须大于未删除的行的rowid
+     * @note 快照中已有该单号时改为原位更新.
+     */
+    void append(qint64 rowid, int id, int cost, int type, int state, int sendingDay, int receivingDay, const QString &srcName, const QString &dstName, const QString &expressman);
+
+    /**
+     * @brief 在原位更新一行
+     * @param id 物品单号
+     * @return true 已更新
+     * @return false 快照中没有该物品
+     */
+    bool update(int id, int cost, int type, int state, int sendingDay, int receivingDay, const QString &srcName, const QString &dstName, const QString &expressman);
+
+    /**
+     * @brief 把一行标记为已删除, 过滤时跳过
+     * @param id 物品单号
+     * @note lastRowid()回退到未删除的最后一行, 重用了已删除行rowid的新行会被下次扫描读到.
+     */
+    void remove(int id);
+
+    /**
+     * @brief 被标记为已删除的行数, 过多时应整体重建
+     */
+    int removedCount() const;
+
+    /**
+     * @brief 未删除的行中最大的rowid, 增量刷新时从它之后读取
+     */
+    qint64 lastRowid() const;
+
+    /**
+     * @brief 行数
+     */
+    int size() const;
+
+    /**
+     * @brief 各列占用的字节数
+     */
+    qint64 memoryBytes() const;
+
+    /**
+     * @brief 按条件过滤
+     * @param filter 查询条件, 不支持includeArchived
+     * @param pool 执行过滤的线程池
+     * @return QVector<int> 满足条件的物品单号, 升序
+     */
+    QVector<int> filter(const ItemFilter &filter, QThreadPool *pool = QThreadPool::globalInstance()) const;
+
+private:
+    QVector<qint32> ids;           //物品单号
+    QVector<qint32> costs;         //快递花费
+    QVector<qint32> types;         //物品类型
+    QVector<qint32> states;        //物品状态
+    QVector<qint32> sendingDays;   //寄送日期键
+    QVector<qint32> receivingDays; //接收日期键
+    QVector<qint32> srcNames;      //寄件用户名的符号
+    QVector<qint32> dstNames;      //收件用户名的符号
+    QVector<qint32> expressmen;    //快递员用户名的符号
+    QVector<qint64> rowids;        //各行在item表中的rowid
+    qint64 maxRowid;               //未删除的行中最大的rowid
+    QHash<int, int> rowOfId;       //物品单号到行号
+    int removedRows;               //被标记为已删除的行数
+};
+
+#endif
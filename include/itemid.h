@@ -0,0 +1,87 @@
+﻿/**
+ * @file itemid.h
+ * @author Haolin Yang
+ * @brief 物品id的分配器
+ * @version 0.1
+ * @date 2022-05-17
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 数据库中持久保存已分配id的高水位. 分配器每次从数据库租用一段连续的id, 段内的id用无锁的计数器分配.
+ * @note 多个线程或多个进程同时写同一个数据库时, 只有租用新段时才需要数据库的写锁, 分配到的id不会重复.
+ * @note 退出时未用完的id在高水位未被其他写者推进时归还, 否则留下空号.
+ */
+
+#ifndef ITEMID_H
+#define ITEMID_H
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <functional>
+
+/**
+ * @brief 从数据库租用一段id
+ * @param count 段的长度
+ * @param first 用于返回段中的第一个id
+ * @return true 租用成功
+ * @return false 租用失败
+ */
+using ItemIdLease = std::function<bool(int count, int &first)>;
+
+/**
+ * @brief 归还一段未使用的id
+ * @param next 第一个未使用的id
+ * @param last 段中的最后一个id
+ */
+using ItemIdGiveBack = std::function<void(int next, int last)>;
+
+/**
+ * @brief 物品id的分配器
+ */
+class ItemIdAllocator
+{
+public:
+    ItemIdAllocator() = delete;
+
+    /**
+     * @brief 构造函数
+     * @param _lease 从数据库租用一段id
+     * @param _giveBack 归还未使用的id
+     * @param _blockSize 每次租用的id数量
+     * @note 构造时不租用, 第一次分配时才租用.
+     */
+    ItemIdAllocator(const ItemIdLease &_lease, const ItemIdGiveBack &_giveBack, int _blockSize);
+
+    /**
+     * @brief 析构函数, 归还当前段中未使用的id
+     */
+    ~ItemIdAllocator();
+
+    /**
+     * @brief 分配一段连续的id
+     * @param count 数量
+     * @return int 第一个id, 失败时返回-1
+     * @note 可以在多个线程中同时调用. 超过段长度的请求单独租用.
+     */
+    int allocate(int count = 1);
+
+    /**
+     * @brief 累计租用的次数
+     */
+    int leaseCount() const;
+
+private:
+    ItemIdLease lease;                //租用一段id
+    ItemIdGiveBack giveBack;          //归还未使用的id
+    int blockSize;                    //每次租用的id数量
+    QAtomicInteger<quint64> block;    //当前段, 高32位是段中最后一个id, 低32位是下一个可分配的id
+    QMutex refillMutex;               //同一时间只有一个线程租用新段
+    QAtomicInteger<int> leases;       //累计租用的次数
+
+    /**
+     * @brief 把下一个id和最后一个id打包成一个64位整数, 使两者可以一次比较并交换
+     */
+    static quint64 pack(int next, int last);
+};
+
+#endif
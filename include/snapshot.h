@@ -0,0 +1,72 @@
+﻿/**
+ * @file snapshot.h
+ * @author Haolin Yang
+ * @brief 用于快速启动的二进制快照
+ * @version 0.1
+ * @date 2022-05-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 正常退出时把用户名集合和用户记录写成一个二进制快照, 下次启动时一次读入, 不再解析用户文件和查询数据库.
+ * @note 快照记录了写入时各个相关文件的大小和修改时间, 任一文件发生变化或校验和不符时快照作废, 退回到正常的启动流程.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "userlog.h"
+
+/**
+ * @brief 一个文件在某一时刻的大小和修改时间
+ */
+struct FileStamp
+{
+    QString fileName; //文件名
+    qint64 size;      //大小, 文件不存在时为-1
+    qint64 mtime;     //修改时间, 文件不存在时为0
+
+    /**
+     * @brief 读取文件当前的大小和修改时间
+     */
+    static FileStamp of(const QString &fileName);
+};
+
+/**
+ * @brief 快速启动快照
+ */
+struct BootSnapshot
+{
+    int userStorage = -1;             //写入快照时用户信息的存储方式
+    QSet<QString> usernames;          //用户名集合, sqlite存储时使用
+    QHash<QString, UserRecord> users; //已解码的用户记录, 文件存储时使用
+    int userLogCount = 0;             //用户变更日志中的条数, 文件存储时使用
+
+    /**
+     * @brief 读取快照
+     * @param fileName 快照文件名
+     * @param watchedStamps 快照依赖的文件在启动时的状态, 需与写入时一致
+     * @param snapshot 用于返回结果
+     * @return true 快照有效
+     * @return false 快照不存在、已损坏或已过期
+     * @note 文件状态由调用者在打开数据库之前读取, 打开数据库时新建的-wal文件不会使快照作废.
+     */
+    static bool load(const QString &fileName, const QVector<FileStamp> &watchedStamps, BootSnapshot &snapshot);
+
+    /**
+     * @brief 写入快照
+     * @param fileName 快照文件名
+     * @param watchedFiles 快照依赖的文件, 记录它们当前的大小和修改时间
+     * @return true 写入成功
+     * @return false 写入失败
+     * @note 先写临时文件再替换, 写到一半退出不会留下损坏的快照.
+     */
+    bool save(const QString &fileName, const QStringList &watchedFiles) const;
+};
+
+#endif
@@ -0,0 +1,93 @@
+﻿/**
+ * @file symbol.h
+ * @author Haolin Yang
+ * @brief 进程内共享的用户名符号表
+ * @version 0.1
+ * @date 2022-05-22
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 寄件人、收件人和快递员在大量物品中反复出现. 每个用户名只保存一份, 物品和在线用户表只保存它的整数符号,
+ * @note 比较用户名变为比较整数. 符号一经分配在进程结束前不会回收, 按符号取用户名不加锁.
+ * @note 第k块存放2^(SYMBOL_CHUNK_BITS+k)个用户名, 表随用户名增多按块倍增, 已有的块不搬移.
+ */
+
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+
+const int SYMBOL_NONE = -1;          //不存在的符号
+const int SYMBOL_EMPTY = 0;          //空串的符号
+const int SYMBOL_CHUNK_BITS = 10;                   //第一块的符号数为2^SYMBOL_CHUNK_BITS
+const int SYMBOL_MAX_CHUNKS = 32 - SYMBOL_CHUNK_BITS; //块数, 各块合起来覆盖int的全部非负值
+
+/**
+ * @brief 用户名符号表
+ */
+class SymbolTable
+{
+public:
+    /**
+     * @brief 进程内唯一的符号表
+     */
+    static SymbolTable &instance();
+
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+
+    /**
+     * @brief 取得用户名的符号, 不存在时新分配
+     * @param name 用户名
+     * @return int 符号, 符号耗尽时为SYMBOL_NONE
+     */
+    int intern(const QString &name);
+
+    /**
+     * @brief 查找用户名的符号, 不分配
+     * @param name 用户名
+     * @return int 符号, 用户名从未出现过时为SYMBOL_NONE
+     */
+    int find(const QString &name) const;
+
+    /**
+     * @brief 符号对应的用户名
+     * @param symbol 符号
+     * @return const QString& 用户名, 符号无效时为空串
+     */
+    const QString &name(int symbol) const;
+
+    /**
+     * @brief 已分配的符号数
+     */
+    int size() const;
+
+private:
+    SymbolTable();
+    ~SymbolTable();
+
+    mutable QReadWriteLock lock;            //保护symbols和分配
+    QHash<QString, int> symbols;            //用户名到符号
+    QString *chunks[SYMBOL_MAX_CHUNKS];     //按符号存放的用户名, 块的大小依次倍增
+    QAtomicInt count;                       //已分配的符号数, 先写入用户名再发布
+};
+
+/**
+ * @brief 取得用户名的符号, 不存在时新分配
+ */
+inline int internSymbol(const QString &name) { return SymbolTable::instance().intern(name); }
+
+/**
+ * @brief 查找用户名的符号, 不存在时为SYMBOL_NONE
+ */
+inline int findSymbol(const QString &name) { return SymbolTable::instance().find(name); }
+
+/**
+ * @brief 符号对应的用户名
+ */
+inline const QString &symbolName(int symbol) { return SymbolTable::instance().name(symbol); }
+
+#endif
@@ -43,6 +43,21 @@ public:
 
     static int getCurDay() { return curDay; };
 
+    /**
+     * @brief 转换为可排序的日期键
+     *
+     * @return int 年*10000+月*100+日, 年为-1(未知时间)时返回-1
+     */
+    int toDayKey() const { return year < 0 ? -1 : year * 10000 + month * 100 + day; }
+
+    /**
+     * @brief 从日期键还原时间
+     *
+     * @param key 日期键
+     * @return Time 对应的时间, key为负时返回Time(-1, -1, -1)
+     */
+    static Time fromDayKey(int key) { return key < 0 ? Time(-1, -1, -1) : Time(key / 10000, key / 100 % 100, key % 100); }
+
     /**
      * @brief 获取物流系统时间
      *
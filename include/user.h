@@ -129,8 +129,10 @@ public:
     /**
      * @brief 插入用户信息到数据库中
      * @param db 数据库
+     * @return true 插入成功
+     * @return false 插入失败
      */
-    void insertInfo2DB(Database *db);
+    bool insertInfo2DB(Database *db);
 
 protected:
     QString username;    //用户名
@@ -317,6 +319,37 @@ public:
      */
     QString registerUser(const QJsonObject &token, const QString &username, const QString &password, int type, const QString &name, const QString &phoneNumber, const QString &address) const;
 
+    /**
+     * @brief 批量注册用户
+     *
+     * @param token 凭据
+     * @param rows 待注册的用户数组
+     * @param failures 注册失败的条目
+     * @return QString 如果批量注册被执行，返回空串(个别条目失败也算执行)，否则返回错误信息.
+     * @note 只有ADMINISTRATOR可以批量注册. 全部条目检查完后一次写入.
+     *
+     * 待注册用户的格式:
+     * ```json
+     * {
+     *      "username" : <字符串>,
+     *      "password" : <字符串>,
+     *      "name" : <字符串>,
+     *      "phonenumber" : <字符串>,
+     *      "address" : <字符串>,
+     *      可选："type" : <整数> 默认为CUSTOMER
+     * }
+     * ```
+     * 注册失败的条目的格式:
+     * ```json
+     * {
+     *      "row" : <整数> 在rows中的下标,
+     *      "username" : <字符串>,
+     *      "error" : <字符串>
+     * }
+     * ```
+     */
+    QString registerUsers(const QJsonObject &token, const QJsonArray &rows, QJsonArray &failures) const;
+
     /**
      * @brief 删除快递员
      *
@@ -394,6 +427,16 @@ public:
      */
     QString queryAllUserInfo(const QJsonObject &token, QJsonArray &ret) const;
 
+    /**
+     * @brief 按用户名顺序分页获取用户信息
+     * @param token 凭据
+     * @param afterUsername 上一页最后一个用户名, 第一页为空串
+     * @param limit 每页数量, 为负数时不限制
+     * @param ret 用户信息数组, 格式同上
+     * @return 如果获取成功，返回空串，否则返回错误信息
+     */
+    QString queryAllUserInfo(const QJsonObject &token, const QString &afterUsername, int limit, QJsonArray &ret) const;
+
     /**
      * @brief 更改余额(单用户)
      * @param token 凭据
@@ -472,9 +515,90 @@ public:
      *      可选："dstName" : <字符串>
      * }
      * ```
+     * 各种格式都还可以给出日期范围(闭区间, 日期键为 年*10000+月*100+日):
+     * ```json
+     * {
+     *      可选："sendingFrom" : <日期键>,
+     *      可选："sendingTo" : <日期键>,
+     *      可选："receivingFrom" : <日期键>,
+     *      可选："receivingTo" : <日期键>
+     * }
+     * ```
+     * 只给出年或年、月时, 按整年或整月的范围查询; 没有给出年时, 月、日分别与每年的月、日比较(例如只给出日时查询每月的这一天);
+     * 给出年和日而没有月时, 查询该年每月的这一天. 月应在1~12之间, 日应在1~31之间, 否则返回错误信息.
+     * 给出"archived" : true时, 不分页的查询还会接着查询已归档的物品.
      */
     QString queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret) const;
 
+    /**
+     * @brief 按照条件分页查询商品
+     * @param token 用户鉴权
+     * @param filter 条件, 格式同上, 另外可以给出分页方式
+     * @param ret 本页的查询结果
+     * @param nextCursor 用于返回下一页的游标, 没有下一页时为空串
+     * @return QString 查询成功则返回空串，否则返回错误信息
+     *
+     * 分页方式:
+     * ```json
+     * {
+     *      可选："limit" : <每页数量>,
+     *      可选："orderBy" : "id" 或 "sendingDay",
+     *      可选："descending" : <布尔值>,
+     *      可选："cursor" : <上一页返回的游标>
+     * }
+     * ```
+     * 翻页时排序方式必须与上一页一致.
+     */
+    QString queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret, QString &nextCursor) const;
+
+    /**
+     * @brief 按照条件查询商品, 每查到一条就交给visitor, 不保存整个结果
+     * @param token 用户鉴权
+     * @param filter 条件, 格式同queryItem
+     * @param visitor 处理每一条结果(格式同queryItem的ret中的一项), 返回false时停止查询
+     * @param nextCursor 用于返回下一页的游标, 提前停止时指向最后处理的一条之后
+     * @return QString 查询成功则返回空串，否则返回错误信息
+     */
+    QString visitItem(const QJsonObject &token, const QJsonObject &filter, const std::function<bool(const QJsonObject &)> &visitor, QString &nextCursor) const;
+
+    /**
+     * @brief 按条件统计物品的数量和费用之和
+     * @param token 用户鉴权
+     * @param filter 条件, 格式同queryItem, 不需要type键
+     * @param groupBy 分组方式: "" 不分组, "state", "type", "expressman", "sendingDay", "receivingDay"
+     * @param ret 每组一项
+     * @return QString 统计成功则返回空串，否则返回错误信息
+     * @note 仅限管理员使用. 每组的格式:
+     * ```json
+     * {
+     *      "key" : <分组的值, 日期分组时为日期键, 不分组时没有此项>,
+     *      "count" : <物品数量>,
+     *      "costSum" : <费用之和>
+     * }
+     * ```
+     */
+    QString aggregateItem(const QJsonObject &token, const QJsonObject &filter, const QString &groupBy, QJsonArray &ret) const;
+
+    /**
+     * @brief 在物品描述中全文搜索
+     * @param token 用户鉴权
+     * @param text 搜索词, 以空格分隔的各词须同时出现
+     * @param filter 条件, 格式同queryItem, 另外可以给出"limit" : <最多返回的数量>
+     * @param ret 物品单号, 按相关度从高到低
+     * @return QString 搜索成功则返回空串，否则返回错误信息
+     */
+    QString searchItem(const QJsonObject &token, const QString &text, const QJsonObject &filter, QJsonArray &ret) const;
+
+    /**
+     * @brief 把签收超过days天的物品移到归档
+     * @param token 用户鉴权
+     * @param days 天数, 以物流系统时间为准
+     * @param count 用于返回归档的物品数量
+     * @return QString 归档成功则返回空串，否则返回错误信息
+     * @note 仅限管理员使用. 归档的物品只有在查询条件中给出"archived" : true时才会被查到.
+     */
+    QString archiveItem(const QJsonObject &token, int days, int &count) const;
+
     /**
      * @brief 发送快递物品
      * @param token 凭据
@@ -531,27 +655,27 @@ public:
     QString assignExpressman(const QJsonObject &token, const QJsonObject &info) const;
 
 private:
-    QMap<QString, QSharedPointer<User>> userMap; //用户名到用户对象的映射.
+    QHash<int, QSharedPointer<User>> userMap; //用户名符号到已登录用户对象的映射, 见SymbolTable.
     Database *db;                                //数据库
     ItemManage *itemManage;                      //物品管理类
 
     /**
      * @brief 用户鉴权
      * @param token 凭据
-     * @return QString 鉴权成功则返回用户名，失败则返回空串.
-     * @note 空串可用isEmpty判断.
+     * @return QSharedPointer<User> 鉴权成功则返回已登录的用户对象，失败则返回空指针.
+     * @note 每个请求只查一次userMap, 之后直接使用返回的用户对象.
      */
-    QString verify(const QJsonObject &token) const;
+    QSharedPointer<User> verify(const QJsonObject &token) const;
 
     /**
      * @brief 转钱: 减少一个用户的余额，增加另一个用户的余额。
-     * @param token 第一个用户（减去转移余额量的用户）的token
+     * @param caller 第一个用户（减去转移余额量的用户），已通过鉴权
      * @param balance 转移余额量
      * @param srcUser 第二个用户（加上转移余额量的用户）的用户名
      * @return QString 转钱成功，返回空串，否则返回错误信息.
      * @note 转移余额量可以为负
      */
-    QString transferBalance(const QJsonObject &token, int balance, const QString &dstUser) const;
+    QString transferBalance(const QSharedPointer<User> &caller, int balance, const QString &dstUser) const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+﻿/**
+ * @file usercommit.h
+ * @author Haolin Yang
+ * @brief 用户变更的组提交队列
+ * @version 0.1
+ * @date 2022-05-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 用户变更先进入队列, 同一用户的多次变更只保留最后一次, 由一个写线程把一批变更一次写入持久存储.
+ * @note 达到批大小、距第一条待写变更超过刷新间隔或有调用者要求确认时, 写线程开始写入.
+ * @note 一次submit提交的多条变更总是在同一批中写入.
+ */
+
+#ifndef USERCOMMIT_H
+#define USERCOMMIT_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <functional>
+
+#include "userlog.h"
+
+/**
+ * @brief 用户变更的组提交队列
+ */
+class UserCommitQueue
+{
+public:
+    UserCommitQueue() = delete;
+
+    /**
+     * @brief 构造函数, 启动写线程
+     * @param _writer 在写线程中把一批变更写入持久存储, 成功返回true
+     * @param _onWriterExit 写线程退出前在写线程中调用, 用于释放线程私有的资源
+     * @param _interval 刷新间隔, 单位毫秒
+     * @param _batchSize 批大小
+     * @param _flushOnAck 是否每次提交都等待写入完成后再返回
+     */
+    UserCommitQueue(std::function<bool(const QList<UserChange> &)> _writer, std::function<void()> _onWriterExit, int _interval, int _batchSize, bool _flushOnAck);
+
+    /**
+     * @brief 析构函数
+     * @note 写完所有待写变更后停止写线程.
+     */
+    ~UserCommitQueue();
+
+    /**
+     * @brief 提交一组变更
+     * @param changes 变更列表
+     * @return true flushOnAck为true时表示所在的批写入成功, 否则表示已进入队列
+     * @return false 所在的批写入失败, 这些变更已被丢弃
+     * @note flushOnAck为true时, 等待这些变更写入完成后返回. 为false时写入失败只记录日志.
+     */
+    bool submit(const QList<UserChange> &changes);
+
+    /**
+     * @brief 等待此前提交的所有变更写入完成
+     */
+    void flush();
+
+    /**
+     * @brief 查询某个用户尚未写入完成的最新变更
+     * @param username 用户名
+     * @param change 用于返回结果
+     * @return true 存在尚未写入完成的变更
+     * @return false 不存在
+     */
+    bool pending(const QString &username, UserChange &change) const;
+
+private:
+    std::function<bool(const QList<UserChange> &)> writer; //写入一批变更
+    std::function<void()> onWriterExit;                    //写线程退出时的清理
+    int interval;                                          //刷新间隔, 单位毫秒
+    int batchSize;                                         //批大小
+    bool flushOnAck;                                       //是否同步等待写入
+
+    mutable QMutex mutex;                 //保护以下成员
+    QWaitCondition writerCondition;       //唤醒写线程
+    QWaitCondition durableCondition;      //唤醒等待写入完成的调用者
+    QList<UserChange> queue;              //待写变更, 同一用户只保留一条
+    QHash<QString, int> queueIndex;       //用户名到queue下标
+    QHash<QString, UserChange> inflight;  //正在被写线程写入的变更
+    QElapsedTimer firstPending;           //第一条待写变更进入队列的时间
+    qint64 submittedSeq;                  //已提交的批次序号
+    qint64 durableSeq;                    //已写入完成的批次序号
+    QMap<qint64, bool> batchResults;      //各批的最大序号到写入结果, 只保留仍有调用者等待的批
+    QMap<qint64, int> waitingSeqs;        //正在等待写入结果的提交序号及其等待者数量
+    bool flushRequested;                  //是否有调用者在等待写入
+    bool stopping;                        //是否正在停止
+    QThread *writerThread;                //写线程
+
+    /**
+     * @brief 写线程的主循环
+     */
+    void run();
+
+    /**
+     * @brief 记录一批的写入结果, 需持有mutex
+     * @param batchSeq 这一批包含的最大提交序号
+     * @param ok 是否写入成功
+     */
+    void recordResult(qint64 batchSeq, bool ok);
+};
+
+#endif
@@ -0,0 +1,218 @@
+﻿/**
+ * @file userlog.h
+ * @author Haolin Yang
+ * @brief 日志结构的用户存储
+ * @version 0.1
+ * @date 2022-05-08
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 用户文件(users.txt)作为基文件, 用户的每次变更只在变更日志(users.log)末尾追加一行.
+ * @note 日志条数达到阈值后, 在后台线程中把内存中的用户索引写成新的基文件, 并丢弃已经合并的日志.
+ * @note 启动时先读基文件, 再按顺序重放日志.
+ * @note 基文件通过内存映射读取, 原地切分字段, 只解码用户名; 其余字段在第一次被访问时才解码.
+ * @note 追加日志可以在组提交的写线程中进行, 日志文件的读写由logMutex保护.
+ */
+
+#ifndef USERLOG_H
+#define USERLOG_H
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+/**
+ * @brief 用户记录, 常驻内存的用户索引中的一项
+ * @note 用户名作为索引的键, 不在记录中重复保存.
+ * @note 从基文件载入的记录在解码前只保存该行在映射中的位置, 此时其余字段无效, 需经UserLog::resolve或UserLog::materialize解码.
+ */
+struct UserRecord
+{
+    QString password;    //密码
+    int type;            //用户类型
+    int balance;         //余额
+    QString name;        //姓名
+    QString phoneNumber; //电话号码
+    QString address;     //地址
+    qint64 rawOffset = -1; //未解码时该行在基文件中的偏移, 已解码为-1
+    int rawLength = 0;     //未解码时该行的长度
+
+    /**
+     * @brief 是否还未解码
+     */
+    bool isRaw() const { return rawOffset >= 0; }
+};
+
+/**
+ * @brief 一条用户变更
+ */
+struct UserChange
+{
+    QString username;  //用户名
+    bool deleted;      //是否为删除
+    UserRecord record; //变更后的用户记录, 必须已解码, 删除时无效
+};
+
+/**
+ * @brief 日志结构的用户存储
+ *
+ * 日志的格式为每行一条记录:
+ * ```
+ * U <用户名> <密码> <类型> <余额> <姓名> <电话号码> <地址>    插入或覆盖一个用户
+ * D <用户名>                                                删除一个用户
+ * ```
+ */
+class UserLog
+{
+public:
+    UserLog() = delete;
+
+    /**
+     * @brief 构造函数
+     * @param _baseFileName 基文件名
+     * @param _compactThreshold 日志条数达到该值时触发压缩
+     * @note 日志文件与基文件位于同一目录, 扩展名为.log.
+     */
+    UserLog(const QString &_baseFileName, int _compactThreshold);
+
+    /**
+     * @brief 析构函数
+     * @note 等待后台压缩结束.
+     */
+    ~UserLog();
+
+    /**
+     * @brief 读取基文件并重放日志, 结果写入index
+     * @param index 用户名到用户记录的索引
+     * @param openForAppend 读取后是否打开日志用于追加, 只读导入时为false
+     * @return true 读取成功
+     * @return false 基文件无法打开
+     */
+    bool load(QHash<QString, UserRecord> &index, bool openForAppend = true);
+
+    /**
+     * @brief 不读取文件, 直接从已知状态继续追加日志
+     * @param count 当前日志中的条数
+     * @note 用于从快照恢复了用户索引的情况.
+     */
+    void resume(int count);
+
+    /**
+     * @brief 当前日志中的条数
+     */
+    int count() const;
+
+    /**
+     * @brief 基文件、当前日志和旧日志的文件名
+     */
+    QStringList fileNames() const;
+
+    /**
+     * @brief 返回解码后的用户记录
+     * @param record 可能未解码的用户记录
+     * @return UserRecord 解码后的副本, record本身不变
+     */
+    UserRecord resolve(const UserRecord &record) const;
+
+    /**
+     * @brief 原地解码用户记录
+     * @param record 可能未解码的用户记录, 解码后不再引用基文件
+     */
+    void materialize(UserRecord &record) const;
+
+    /**
+     * @brief 一次写入追加一批用户变更的日志
+     * @param changes 用户变更列表
+     * @return true 已写入并刷新
+     * @return false 日志未打开或写入失败
+     */
+    bool appendChanges(const QList<UserChange> &changes);
+
+    /**
+     * @brief 日志条数是否已达到压缩阈值
+     */
+    bool needsCompaction() const;
+
+    /**
+     * @brief 将index写为新的基文件
+     * @param index 当前的用户索引
+     * @param background 是否在后台线程中写入
+     * @note 调用后立即切换到新的日志文件, 之后的变更不会丢失.
+     * @note 替换基文件前必须解除映射, 因此会先解码index中所有未解码的记录.
+     */
+    void compact(QHash<QString, UserRecord> &index, bool background = true);
+
+    /**
+     * @brief 等待正在进行的后台压缩结束
+     */
+    void waitForCompaction();
+
+    /**
+     * @brief 将一个用户格式化为基文件中的一行(不含换行)
+     */
+    static QString formatRecord(const QString &username, const UserRecord &record);
+
+private:
+    QString baseFileName;       //基文件
+    QString logFileName;        //当前的变更日志
+    QString compactingFileName; //正在被压缩的旧日志
+    int compactThreshold;       //触发压缩的日志条数
+    int logCount;               //当前日志中的条数
+    mutable QMutex logMutex;    //保护logFile和logCount
+    QFile logFile;              //当前日志, 保持打开以便追加
+    QThread *compactThread;     //后台压缩线程
+    QFile baseFile;             //基文件, 映射期间保持打开
+    uchar *baseMap;             //基文件的内存映射
+    QByteArray baseBuffer;      //无法映射时退化为一次性读入的缓冲区
+    const char *baseData;       //基文件内容, 指向baseMap或baseBuffer
+    qint64 baseSize;            //基文件大小
+
+    /**
+     * @brief 映射基文件并切分出每一行, 只解码用户名
+     * @param index 用户索引
+     * @param createIfMissing 基文件不存在时是否创建
+     * @return true 读取成功
+     * @return false 基文件无法打开
+     */
+    bool parseBase(QHash<QString, UserRecord> &index, bool createIfMissing);
+
+    /**
+     * @brief 解码index中所有未解码的记录并解除基文件的映射
+     */
+    void releaseBase(QHash<QString, UserRecord> &index);
+
+    /**
+     * @brief 一次写入追加多行到日志末尾并刷新
+     * @param lines 多行日志(不含换行)
+     * @return true 已写入并刷新
+     * @return false 日志未打开或写入失败
+     */
+    bool appendLines(const QStringList &lines);
+
+    /**
+     * @brief 打开当前日志用于追加
+     */
+    void openLog();
+
+    /**
+     * @brief 重放一个日志文件
+     * @param fileName 日志文件名
+     * @param index 用户索引
+     * @return int 重放的条数
+     */
+    static int replay(const QString &fileName, QHash<QString, UserRecord> &index);
+
+    /**
+     * @brief 将index写为新的基文件, 并删除已合并的旧日志
+     * @return true 写入成功
+     * @return false 写入失败, 旧的基文件和旧日志都保持不变
+     * @note 基文件以rename原子替换.
+     */
+    static bool writeBase(const QString &baseFileName, const QString &compactingFileName, const QHash<QString, UserRecord> &index);
+};
+
+#endif
@@ -46,11 +46,87 @@ void messageHandler(QtMsgType type, const QMessageLogContext &context, const QSt
     }
 }
 
+/**
+ * @brief 检查命令行中从first开始的年、月、日三个日期参数
+ * @note 年的位置也可以是日期范围"<起始>~<结束>", 两端为日期键(年*10000+月*100+日), 任一端可以省略, 此时月和日必须为*.
+ */
+bool isDateArgs(const QStringList &args, int first)
+{
+    bool ok;
+    if (args[first].contains('~'))
+    {
+        QStringList bounds = args[first].split('~');
+        if (bounds.size() != 2)
+            return false;
+        for (const QString &bound : bounds)
+            if (!bound.isEmpty() && !(bound.toInt(&ok) >= 0 && ok))
+                return false;
+        return args[first + 1] == "*" && args[first + 2] == "*";
+    }
+    for (int i = first; i < first + 3; i++)
+        if (args[i] != "*" && !(args[i].toInt(&ok) || ok))
+            return false;
+    return true;
+}
+
+/**
+ * @brief 把命令行中从first开始的日期参数写入查询条件
+ */
+void insertDateArgs(const QStringList &args, int first, const QString &prefix, const QString &fromKey, const QString &toKey, QJsonObject &filter)
+{
+    if (args[first].contains('~'))
+    {
+        QStringList bounds = args[first].split('~');
+        if (!bounds[0].isEmpty())
+            filter.insert(fromKey, bounds[0].toInt());
+        if (!bounds[1].isEmpty())
+            filter.insert(toKey, bounds[1].toInt());
+        return;
+    }
+    if (args[first] != "*")
+        filter.insert(prefix + "_Year", args[first].toInt());
+    if (args[first + 1] != "*")
+        filter.insert(prefix + "_Month", args[first + 1].toInt());
+    if (args[first + 2] != "*")
+        filter.insert(prefix + "_Day", args[first + 2].toInt());
+}
+
+/**
+ * @brief 检查命令行中从first开始的分页参数: [每页数量] [排序方式] [游标]
+ * @note 排序方式为 id、-id、day、-day, 带-为降序.
+ */
+bool isPageArgs(const QStringList &args, int first)
+{
+    bool ok;
+    if (args.size() > first && !(args[first].toInt(&ok) > 0 && ok))
+        return false;
+    if (args.size() > first + 1 && !QStringList({"id", "-id", "day", "-day"}).contains(args[first + 1]))
+        return false;
+    return args.size() <= first + 3;
+}
+
+/**
+ * @brief 把命令行中从first开始的分页参数写入查询条件
+ */
+void insertPageArgs(const QStringList &args, int first, QJsonObject &filter)
+{
+    if (args.size() > first)
+        filter.insert("limit", args[first].toInt());
+    if (args.size() > first + 1)
+    {
+        filter.insert("orderBy", args[first + 1].endsWith("day") ? "sendingDay" : "id");
+        filter.insert("descending", args[first + 1].startsWith("-"));
+    }
+    if (args.size() > first + 2)
+        filter.insert("cursor", args[first + 2]);
+}
+
 int main()
 {
     qInstallMessageHandler(messageHandler); // Qt自带的输出详细日志
-    Database database("defaultConnection", "../data/users.txt");
-    ItemManage itemManage(&database);
+    DatabaseConfig config = DatabaseConfig::load("../data/config.ini");
+    Database database("defaultConnection", "../data/users.txt", config);
+    ItemManage itemManage(&database, config.itemCacheSize, config.itemColumnar);
     UserManage userManage(&database, &itemManage);
 
     QTextStream istream(stdin);
@@ -64,6 +140,15 @@ int main()
     QString input;
     Time::init();
 
+    //查询结果逐条打印，不保存整个结果
+    auto printItem = [&](const QJsonObject &item)
+    {
+        qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt() << "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
+                << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
+                << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
+        return true;
+    };
+
     qInfo() << "欢迎使用本物流系统，输入 help 获得帮助。";
 
     while (true)
@@ -82,8 +167,10 @@ int main()
             qInfo() << "登出: logout";
             qInfo() << "修改密码: changepassword <新密码>";
             qInfo() << "查看个人信息: info";
-            qInfo() << "查看所有用户信息: alluserinfo";
+            qInfo() << "查看所有用户信息: alluserinfo [每页数量] [上一页最后的用户名]";
             qInfo() << "    注意此功能仅限管理员使用。";
+            qInfo() << "批量注册: registerbatch <文件名>";
+            qInfo() << "    文件每行一个用户：<用户名> <密码> <姓名> <电话号码> <地址>。注意此功能仅限管理员使用。";
             qInfo() << "添加快递员: addexpressman <用户名> <密码> <姓名> <电话号码> <地址>";
             qInfo() << "    注意此功能仅限管理员使用。";
             qInfo() << "删除快递员: deleteexpressman <用户名>";
@@ -93,16 +180,26 @@ int main()
             qInfo() << "运送一个快递: delivery <物品单号>";
             qInfo() << "    注意此功能仅限快递员使用。";
             qInfo() << "充值: addbalance <增加量>";
-            qInfo() << "查询所有快递: queryallitem";
+            qInfo() << "查询所有快递: queryallitem [每页数量] [排序方式] [游标]";
+            qInfo() << "    排序方式为 id、-id、day、-day，带-为降序。翻页时把上一页给出的游标附在最后。";
             qInfo() << "    注意此功能仅限管理员使用。";
             qInfo() << "查询所有符合条件的快递: query <物品单号> <寄送时间年> <寄送时间月> <寄送时间日> <接收时间年> <接收时间月> <接收时间日> <寄件用户的用户名> <收件用户的用户名> <快递员的用户名> <快递状态>";
             qInfo() << "    若要查询所有符合该条件的物品，则该条件用*代替。注意此功能仅限管理员使用。其中快递状态：1 待揽收 2 待签收 3 已签收。";
             qInfo() << "查询快递员所属所有符合条件的快递: queryexpress <物品单号> <寄送时间年> <寄送时间月> <寄送时间日> <接收时间年> <接收时间月> <接收时间日> <寄件用户的用户名> <收件用户的用户名> <快递状态>";
-            qInfo() << "    注意此功能仅限快递员使用。若要查询所有符合该条件的物品，则该条件用*代替。若要查询全部，可以只输入queryexpress。";
+            qInfo() << "    注意此功能仅限快递员使用。若要查询所有符合该条件的物品，则该条件用*代替。若要查询全部，可以只输入queryexpress [每页数量] [排序方式] [游标]。";
             qInfo() << "查找发出的符合条件的快递: querysrc <物品单号> <寄送时间年> <寄送时间月> <寄送时间日> <接收时间年> <接收时间月> <接收时间日> <收件用户的用户名> <快递状态>";
-            qInfo() << "    若要查询所有符合该条件的物品，则该条件用*代替。若要查询全部，可以只输入querysrc。其中快递状态：1 待揽收 2 待签收 3 已签收。";
+            qInfo() << "    若要查询所有符合该条件的物品，则该条件用*代替。若要查询全部，可以只输入querysrc [每页数量] [排序方式] [游标]。其中快递状态：1 待揽收 2 待签收 3 已签收。";
             qInfo() << "查找将收到的符合条件的快递: querysrc <物品单号> <寄送时间年> <寄送时间月> <寄送时间日> <接收时间年> <接收时间月> <接收时间日> <寄件用户的用户名> <快递状态>";
-            qInfo() << "    若要查询所有符合该条件的物品，则该条件用*代替。若要查询全部，可以只输入querydst。其中快递状态：1 待揽收 2 待签收 3 已签收。";
+            qInfo() << "    若要查询所有符合该条件的物品，则该条件用*代替。若要查询全部，可以只输入querydst [每页数量] [排序方式] [游标]。其中快递状态：1 待揽收 2 待签收 3 已签收。";
+            qInfo() << "    以上查询中，年的位置也可以是日期范围 <起始>~<结束>，如 20220301~20220531 或 20220501~，此时月和日用*代替。";
+            qInfo() << "统计快递: stat [分组方式] [寄送日期范围]";
+            qInfo() << "    分组方式为 all、state、type、expressman、day、receivingday，日期范围如 20220301~20220531。给出每组的数量和费用之和，注意此功能仅限管理员使用。";
+            qInfo() << "按描述搜索快递: search <范围> <关键词>...";
+            qInfo() << "    范围为 all、src、dst、express，分别为所有快递(仅限管理员)、发出的、将收到的、派送的快递。结果按相关度排序。";
+            qInfo() << "归档快递: archive [天数]";
+            qInfo() << "    把签收超过指定天数(默认为配置中的archive/afterDays)的快递移到归档。注意此功能仅限管理员使用。";
+            qInfo() << "查询含归档的快递: queryarchived <物品单号>";
+            qInfo() << "    注意此功能仅限管理员使用。";
             qInfo() << "发送快递: send <收件用户的用户名> <物品类别> <数量> <描述>";
             qInfo() << "    其中<物品类别>为整数：1 易碎品 2 图书 3普通快递 <数量>为整数： 易碎品单位为斤 图书单位为本 普通快递单位为斤 若为小数则向上取整计算价格";
             qInfo() << "接收快递: receive <物品单号>";
@@ -197,7 +294,7 @@ int main()
                         << "住址为" << retInfo["address"].toString();
             }
         }
-        else if (args[0] == "alluserinfo" && args.size() == 1)
+        else if (args[0] == "alluserinfo" && args.size() <= 3 && (args.size() == 1 || (args[1].toInt(&ok) && ok)))
         {
             if (token.isNull())
             {
@@ -205,7 +302,7 @@ int main()
                 continue;
             }
             QJsonArray queryRet;
-            QString ret = userManage.queryAllUserInfo(token.toObject(), queryRet);
+            QString ret = userManage.queryAllUserInfo(token.toObject(), args.size() == 3 ? args[2] : "", args.size() >= 2 ? args[1].toInt() : -1, queryRet);
             if (ret.isEmpty())
             {
                 qInfo() << "查询成功";
@@ -236,6 +333,52 @@ int main()
             else
                 qInfo() << "用户 " << args[1] << " 注册失败" << ret;
         }
+        else if (args[0] == "registerbatch" && args.size() == 2)
+        {
+            if (token.isNull())
+            {
+                qInfo() << "当前没有用户登录，请登录后重试。";
+                continue;
+            }
+            QFile batchFile(args[1]);
+            if (!batchFile.open(QIODevice::ReadOnly | QIODevice::Text))
+            {
+                qInfo() << "无法打开文件" << args[1];
+                continue;
+            }
+            QTextStream batchStream(&batchFile);
+            QJsonArray rows;
+            QString line;
+            while (batchStream.readLineInto(&line))
+            {
+                QStringList fields = line.split(" ");
+                QJsonObject row;
+                row.insert("username", fields[0]);
+                if (fields.size() == 5)
+                {
+                    row.insert("password", fields[1]);
+                    row.insert("name", fields[2]);
+                    row.insert("phonenumber", fields[3]);
+                    row.insert("address", fields[4]);
+                }
+                rows.append(row);
+            }
+            batchFile.close();
+
+            QJsonArray failures;
+            QString ret = userManage.registerUsers(token.toObject(), rows, failures);
+            if (ret.isEmpty())
+            {
+                qInfo() << "批量注册完成，成功" << rows.size() - failures.size() << "个，失败" << failures.size() << "个";
+                for (const auto &i : failures)
+                {
+                    QJsonObject failure = i.toObject();
+                    qInfo() << "第" << failure["row"].toInt() + 1 << "行" << failure["username"].toString() << "注册失败" << failure["error"].toString();
+                }
+            }
+            else
+                qInfo() << "批量注册失败" << ret;
+        }
         else if (args[0] == "deleteexpressman" && args.size() == 2)
         {
             if (token.isNull())
@@ -299,7 +442,7 @@ int main()
             else
                 qInfo() << "余额充值失败 " << ret;
         }
-        else if (args[0] == "queryallitem" && args.size() == 1)
+        else if (args[0] == "queryallitem" && isPageArgs(args, 1))
         {
             if (token.isNull())
             {
@@ -308,20 +451,124 @@ int main()
             }
             QJsonObject filter;
             filter.insert("type", 0);
-            QJsonArray queryRet;
-            QString ret = userManage.queryItem(token.toObject(), filter, queryRet);
-            if (ret.isEmpty())
-                for (const auto &i : queryRet)
+            insertPageArgs(args, 1, filter);
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
+                qInfo() << "查询失败" << ret;
+            else if (!nextCursor.isEmpty())
+                qInfo() << "还有更多快递，下一页的游标为" << nextCursor;
+        }
+        else if (args[0] == "stat" && args.size() <= 3 && (args.size() < 3 || args[2].contains('~')))
+        {
+            if (token.isNull())
+            {
+                qInfo() << "当前没有用户登录，请登录后重试。";
+                continue;
+            }
+            static const QMap<QString, QString> groupNames{{"all", ""}, {"state", "state"}, {"type", "type"}, {"expressman", "expressman"}, {"day", "sendingDay"}, {"receivingday", "receivingDay"}};
+            QString group = args.size() >= 2 ? args[1].toLower() : "all";
+            if (!groupNames.contains(group))
+            {
+                qInfo() << "分组方式有误";
+                continue;
+            }
+            QJsonObject filter;
+            if (args.size() == 3)
+            {
+                QStringList bounds = args[2].split('~');
+                if (!bounds[0].isEmpty())
+                    filter.insert("sendingFrom", bounds[0].toInt());
+                if (!bounds[1].isEmpty())
+                    filter.insert("sendingTo", bounds[1].toInt());
+            }
+            QJsonArray statRet;
+            QString ret = userManage.aggregateItem(token.toObject(), filter, groupNames[group], statRet);
+            if (!ret.isEmpty())
+            {
+                qInfo() << "统计失败" << ret;
+                continue;
+            }
+            for (const auto &i : statRet)
+            {
+                QJsonObject row = i.toObject();
+                QString key;
+                if (group == "state")
+                    key = itemState.value(row["key"].toInt());
+                else if (group == "type")
+                    key = itemType.value(row["key"].toInt());
+                else if (group == "day" || group == "receivingday")
                 {
-                    QJsonObject item = i.toObject();
-                    qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt()<< "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
-                            << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
-                            << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
+                    Time day = Time::fromDayKey(row["key"].toInt());
+                    key = day.year == -1 ? "未知" : QString("%1/%2/%3").arg(day.year).arg(day.month).arg(day.day);
                 }
+                else if (group == "expressman")
+                    key = row["key"].toString();
+                qInfo() << key << "数量为" << row["count"].toInt() << "费用之和为" << qint64(row["costSum"].toDouble());
+            }
+        }
+        else if (args[0] == "search" && args.size() >= 3)
+        {
+            if (token.isNull())
+            {
+                qInfo() << "当前没有用户登录，请登录后重试。";
+                continue;
+            }
+            static const QStringList scopes{"all", "src", "dst", "express"};
+            int scope = scopes.indexOf(args[1].toLower());
+            if (scope == -1)
+            {
+                qInfo() << "范围有误";
+                continue;
+            }
+            QJsonObject filter;
+            filter.insert("type", scope);
+            QJsonArray ids;
+            QString ret = userManage.searchItem(token.toObject(), args.mid(2).join(" "), filter, ids);
+            if (!ret.isEmpty())
+            {
+                qInfo() << "搜索失败" << ret;
+                continue;
+            }
+            qInfo() << "搜索到" << ids.size() << "个快递";
+            for (const auto &i : ids)
+            {
+                filter.insert("id", i.toInt());
+                QString nextCursor;
+                userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            }
+        }
+        else if (args[0] == "archive" && args.size() <= 2 && (args.size() == 1 || (args[1].toInt(&ok) >= 0 && ok)))
+        {
+            if (token.isNull())
+            {
+                qInfo() << "当前没有用户登录，请登录后重试。";
+                continue;
+            }
+            int count = 0;
+            QString ret = userManage.archiveItem(token.toObject(), args.size() == 2 ? args[1].toInt() : config.archiveAfterDays, count);
+            if (ret.isEmpty())
+                qInfo() << "归档成功，共" << count << "个快递";
             else
+                qInfo() << "归档失败" << ret;
+        }
+        else if (args[0] == "queryarchived" && args.size() == 2 && args[1].toInt(&ok) && ok)
+        {
+            if (token.isNull())
+            {
+                qInfo() << "当前没有用户登录，请登录后重试。";
+                continue;
+            }
+            QJsonObject filter;
+            filter.insert("type", 0);
+            filter.insert("id", args[1].toInt());
+            filter.insert("archived", true);
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
                 qInfo() << "查询失败" << ret;
         }
-        else if (args[0] == "query" && args.size() == 12 && ((args[1] == '*') || args[1].toInt(&ok) && ok) && ((args[2] == '*') || args[2].toInt(&ok) && ok) && ((args[3] == '*') || args[3].toInt(&ok) && ok) && ((args[4] == '*') || args[4].toInt(&ok) && ok) && ((args[5] == '*') || args[5].toInt(&ok) && ok) && ((args[6] == '*') || args[6].toInt(&ok) && ok) && ((args[7] == '*') || args[7].toInt(&ok) && ok) && ((args[11] == '*') || args[11].toInt(&ok) && ok))
+        else if (args[0] == "query" && args.size() == 12 && ((args[1] == '*') || args[1].toInt(&ok) && ok) && isDateArgs(args, 2) && isDateArgs(args, 5) && ((args[11] == '*') || args[11].toInt(&ok) && ok))
         {
             if (token.isNull())
             {
@@ -332,18 +579,8 @@ int main()
             filter.insert("type", 0);
             if (args[1] != "*")
                 filter.insert("id", args[1].toInt());
-            if (args[2] != "*")
-                filter.insert("sendingTime_Year", args[2].toInt());
-            if (args[3] != "*")
-                filter.insert("sendingTime_Month", args[3].toInt());
-            if (args[4] != "*")
-                filter.insert("sendingTime_Day", args[4].toInt());
-            if (args[5] != "*")
-                filter.insert("receivingTime_Year", args[5].toInt());
-            if (args[6] != "*")
-                filter.insert("receivingTime_Month", args[6].toInt());
-            if (args[7] != "*")
-                filter.insert("receivingTime_Day", args[7].toInt());
+            insertDateArgs(args, 2, "sendingTime", "sendingFrom", "sendingTo", filter);
+            insertDateArgs(args, 5, "receivingTime", "receivingFrom", "receivingTo", filter);
             if (args[8] != "*")
                 filter.insert("srcName", args[8]);
             if (args[9] != "*")
@@ -352,20 +589,12 @@ int main()
                 filter.insert("expressman", args[10]);
             if (args[11] != "*")
                 filter.insert("state", args[11].toInt());
-            QJsonArray queryRet;
-            QString ret = userManage.queryItem(token.toObject(), filter, queryRet);
-            if (ret.isEmpty())
-                for (const auto &i : queryRet)
-                {
-                    QJsonObject item = i.toObject();
-                    qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt() << "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
-                            << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
-                            << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
-                }
-            else
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
                 qInfo() << "查询失败" << ret;
         }
-        else if (args[0] == "querysrc" && args.size() == 11 && ((args[1] == '*') || args[1].toInt(&ok) && ok) && ((args[2] == '*') || args[2].toInt(&ok) && ok) && ((args[3] == '*') || args[3].toInt(&ok) && ok) && ((args[4] == '*') || args[4].toInt(&ok) && ok) && ((args[5] == '*') || args[5].toInt(&ok) && ok) && ((args[6] == '*') || args[6].toInt(&ok) && ok) && ((args[7] == '*') || args[7].toInt(&ok) && ok) && ((args[10] == '*') || args[10].toInt(&ok) && ok))
+        else if (args[0] == "querysrc" && args.size() == 11 && ((args[1] == '*') || args[1].toInt(&ok) && ok) && isDateArgs(args, 2) && isDateArgs(args, 5) && ((args[10] == '*') || args[10].toInt(&ok) && ok))
         {
             if (token.isNull())
             {
@@ -376,38 +605,20 @@ int main()
             filter.insert("type", 1);
             if (args[1] != "*")
                 filter.insert("id", args[1].toInt());
-            if (args[2] != "*")
-                filter.insert("sendingTime_Year", args[2].toInt());
-            if (args[3] != "*")
-                filter.insert("sendingTime_Month", args[3].toInt());
-            if (args[4] != "*")
-                filter.insert("sendingTime_Day", args[4].toInt());
-            if (args[5] != "*")
-                filter.insert("receivingTime_Year", args[5].toInt());
-            if (args[6] != "*")
-                filter.insert("receivingTime_Month", args[6].toInt());
-            if (args[7] != "*")
-                filter.insert("receivingTime_Day", args[7].toInt());
+            insertDateArgs(args, 2, "sendingTime", "sendingFrom", "sendingTo", filter);
+            insertDateArgs(args, 5, "receivingTime", "receivingFrom", "receivingTo", filter);
             if (args[8] != "*")
                 filter.insert("dstName", args[8]);
             if (args[9] != "*")
                 filter.insert("expressman", args[9]);
             if (args[10] != "*")
                 filter.insert("state", args[10].toInt());
-            QJsonArray queryRet;
-            QString ret = userManage.queryItem(token.toObject(), filter, queryRet);
-            if (ret.isEmpty())
-                for (const auto &i : queryRet)
-                {
-                    QJsonObject item = i.toObject();
-                    qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt() << "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
-                            << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
-                            << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
-                }
-            else
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
                 qInfo() << "查询失败" << ret;
         }
-        else if (args[0] == "querysrc" && args.size() == 1)
+        else if (args[0] == "querysrc" && isPageArgs(args, 1))
         {
             if (token.isNull())
             {
@@ -416,20 +627,15 @@ int main()
             }
             QJsonObject filter;
             filter.insert("type", 1);
-            QJsonArray queryRet;
-            QString ret = userManage.queryItem(token.toObject(), filter, queryRet);
-            if (ret.isEmpty())
-                for (const auto &i : queryRet)
-                {
-                    QJsonObject item = i.toObject();
-                    qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt() << "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
-                            << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
-                            << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
-                }
-            else
+            insertPageArgs(args, 1, filter);
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
                 qInfo() << "查询失败" << ret;
+            else if (!nextCursor.isEmpty())
+                qInfo() << "还有更多快递，下一页的游标为" << nextCursor;
         }
-        else if (args[0] == "querydst" && args.size() == 11 && ((args[1] == '*') || args[1].toInt(&ok) && ok) && ((args[2] == '*') || args[2].toInt(&ok) && ok) && ((args[3] == '*') || args[3].toInt(&ok) && ok) && ((args[4] == '*') || args[4].toInt(&ok) && ok) && ((args[5] == '*') || args[5].toInt(&ok) && ok) && ((args[6] == '*') || args[6].toInt(&ok) && ok) && ((args[7] == '*') || args[7].toInt(&ok) && ok) && ((args[10] == '*') || args[10].toInt(&ok) && ok))
+        else if (args[0] == "querydst" && args.size() == 11 && ((args[1] == '*') || args[1].toInt(&ok) && ok) && isDateArgs(args, 2) && isDateArgs(args, 5) && ((args[10] == '*') || args[10].toInt(&ok) && ok))
         {
             if (token.isNull())
             {
@@ -440,38 +646,20 @@ int main()
             filter.insert("type", 2);
             if (args[1] != "*")
                 filter.insert("id", args[1].toInt());
-            if (args[2] != "*")
-                filter.insert("sendingTime_Year", args[2].toInt());
-            if (args[3] != "*")
-                filter.insert("sendingTime_Month", args[3].toInt());
-            if (args[4] != "*")
-                filter.insert("sendingTime_Day", args[4].toInt());
-            if (args[5] != "*")
-                filter.insert("receivingTime_Year", args[5].toInt());
-            if (args[6] != "*")
-                filter.insert("receivingTime_Month", args[6].toInt());
-            if (args[7] != "*")
-                filter.insert("receivingTime_Day", args[7].toInt());
+            insertDateArgs(args, 2, "sendingTime", "sendingFrom", "sendingTo", filter);
+            insertDateArgs(args, 5, "receivingTime", "receivingFrom", "receivingTo", filter);
             if (args[8] != "*")
                 filter.insert("srcName", args[8]);
             if (args[9] != "*")
                 filter.insert("expressman", args[9]);
             if (args[10] != "*")
                 filter.insert("state", args[10].toInt());
-            QJsonArray queryRet;
-            QString ret = userManage.queryItem(token.toObject(), filter, queryRet);
-            if (ret.isEmpty())
-                for (const auto &i : queryRet)
-                {
-                    QJsonObject item = i.toObject();
-                    qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt() << "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
-                            << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
-                            << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
-                }
-            else
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
                 qInfo() << "查询失败" << ret;
         }
-        else if (args[0] == "querydst" && args.size() == 1)
+        else if (args[0] == "querydst" && isPageArgs(args, 1))
         {
             if (token.isNull())
             {
@@ -480,20 +668,15 @@ int main()
             }
             QJsonObject filter;
             filter.insert("type", 2);
-            QJsonArray queryRet;
-            QString ret = userManage.queryItem(token.toObject(), filter, queryRet);
-            if (ret.isEmpty())
-                for (const auto &i : queryRet)
-                {
-                    QJsonObject item = i.toObject();
-                    qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt() << "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
-                            << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
-                            << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
-                }
-            else
+            insertPageArgs(args, 1, filter);
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
                 qInfo() << "查询失败" << ret;
+            else if (!nextCursor.isEmpty())
+                qInfo() << "还有更多快递，下一页的游标为" << nextCursor;
         }
-        else if (args[0] == "queryexpress" && args.size() == 12 && ((args[1] == '*') || args[1].toInt(&ok) && ok) && ((args[2] == '*') || args[2].toInt(&ok) && ok) && ((args[3] == '*') || args[3].toInt(&ok) && ok) && ((args[4] == '*') || args[4].toInt(&ok) && ok) && ((args[5] == '*') || args[5].toInt(&ok) && ok) && ((args[6] == '*') || args[6].toInt(&ok) && ok) && ((args[7] == '*') || args[7].toInt(&ok) && ok) && ((args[11] == '*') || args[11].toInt(&ok) && ok))
+        else if (args[0] == "queryexpress" && args.size() == 12 && ((args[1] == '*') || args[1].toInt(&ok) && ok) && isDateArgs(args, 2) && isDateArgs(args, 5) && ((args[11] == '*') || args[11].toInt(&ok) && ok))
         {
             if (token.isNull())
             {
@@ -504,18 +687,8 @@ int main()
             filter.insert("type", 3);
             if (args[1] != "*")
                 filter.insert("id", args[1].toInt());
-            if (args[2] != "*")
-                filter.insert("sendingTime_Year", args[2].toInt());
-            if (args[3] != "*")
-                filter.insert("sendingTime_Month", args[3].toInt());
-            if (args[4] != "*")
-                filter.insert("sendingTime_Day", args[4].toInt());
-            if (args[5] != "*")
-                filter.insert("receivingTime_Year", args[5].toInt());
-            if (args[6] != "*")
-                filter.insert("receivingTime_Month", args[6].toInt());
-            if (args[7] != "*")
-                filter.insert("receivingTime_Day", args[7].toInt());
+            insertDateArgs(args, 2, "sendingTime", "sendingFrom", "sendingTo", filter);
+            insertDateArgs(args, 5, "receivingTime", "receivingFrom", "receivingTo", filter);
             if (args[8] != "*")
                 filter.insert("srcName", args[8]);
             if (args[9] != "*")
@@ -524,20 +697,12 @@ int main()
                 filter.insert("expressman", args[10]);
             if (args[11] != "*")
                 filter.insert("state", args[11].toInt());
-            QJsonArray queryRet;
-            QString ret = userManage.queryItem(token.toObject(), filter, queryRet);
-            if (ret.isEmpty())
-                for (const auto &i : queryRet)
-                {
-                    QJsonObject item = i.toObject();
-                    qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt() << "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
-                            << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
-                            << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
-                }
-            else
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
                 qInfo() << "查询失败" << ret;
         }
-        else if (args[0] == "queryexpress" && args.size() == 1)
+        else if (args[0] == "queryexpress" && isPageArgs(args, 1))
         {
             if (token.isNull())
             {
@@ -546,18 +711,13 @@ int main()
             }
             QJsonObject filter;
             filter.insert("type", 3);
-            QJsonArray queryRet;
-            QString ret = userManage.queryItem(token.toObject(), filter, queryRet);
-            if (ret.isEmpty())
-                for (const auto &i : queryRet)
-                {
-                    QJsonObject item = i.toObject();
-                    qInfo() << "物品单号为 " << item["id"].toInt() << " 花费为 " << item["cost"].toInt() << "快递类型为 " << itemType[item["type"].toInt()] << " 状态为 " << itemState[item["state"].toInt()] << " 寄送时间为 " << item["sendingTime_Year"].toInt() << "/" << item["sendingTime_Month"].toInt() << "/" << item["sendingTime_Day"].toInt()
-                            << " 接收时间为 " << item["receivingTime_Year"].toInt() << "/" << item["receivingTime_Month"].toInt() << "/" << item["receivingTime_Day"].toInt() << "/"
-                            << " 寄件人为 " << item["srcName"].toString() << "收件人为" << item["dstName"].toString() << "快递员为" << item["expressman"].toString() << "描述为" << item["description"].toString();
-                }
-            else
+            insertPageArgs(args, 1, filter);
+            QString nextCursor;
+            QString ret = userManage.visitItem(token.toObject(), filter, printItem, nextCursor);
+            if (!ret.isEmpty())
                 qInfo() << "查询失败" << ret;
+            else if (!nextCursor.isEmpty())
+                qInfo() << "还有更多快递，下一页的游标为" << nextCursor;
         }
         else if (args[0] == "send" && args.size() == 5 && args[2].toInt(&ok) && ok && args[3].toDouble(&ok) && ok)
         {
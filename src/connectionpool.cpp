@@ -0,0 +1,217 @@
+﻿/**
+ * @file connectionpool.cpp
+ * @author Haolin Yang
+ * @brief SQLite连接池的实现
+ * @version 0.1
+ * @date 2022-05-16
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/connectionpool.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QtAlgorithms>
+
+bool SqliteProfile::preset(const QString &name, SqliteProfile &profile)
+{
+    if (name == "durable")
+    {
+        profile = SqliteProfile();
+        return true;
+    }
+    if (name == "throughput")
+    {
+        profile = SqliteProfile();
+        profile.name = name;
+        profile.synchronous = "NORMAL";
+        profile.cacheSize = -65536;
+        profile.mmapSize = 268435456;
+        profile.tempStore = "MEMORY";
+        return true;
+    }
+    return false;
+}
+
+void ConnectionPool::applyProfile(QSqlDatabase &connection, const SqliteProfile &profile, bool writable, bool report)
+{
+    //page_size要在切换到WAL之前设置，才能作用于新建的数据库
+    QStringList pragmas;
+    if (writable)
+        pragmas << "page_size = " + QString::number(profile.pageSize) << "journal_mode = " + profile.journalMode;
+    pragmas << "synchronous = " + profile.synchronous
+            << "cache_size = " + QString::number(profile.cacheSize)
+            << "mmap_size = " + QString::number(profile.mmapSize)
+            << "temp_store = " + profile.tempStore;
+    QSqlQuery sqlQuery(connection);
+    for (const QString &pragma : pragmas)
+        if (!sqlQuery.exec("PRAGMA " + pragma))
+            qWarning() << "数据库：设置" << pragma << "失败" << sqlQuery.lastError();
+    if (!report)
+        return;
+
+    QStringList active;
+    for (const char *name : {"journal_mode", "synchronous", "cache_size", "mmap_size", "temp_store", "page_size"})
+        if (sqlQuery.exec(QString("PRAGMA ") + name) && sqlQuery.next())
+            active.append(QString(name) + "=" + sqlQuery.value(0).toString());
+    qInfo() << "数据库：SQLite设置" << profile.name << active.join(", ");
+}
+
+ConnectionPool::ConnectionPool(const QString &_name, const QString &_databaseName, const SqliteProfile &_profile, int _maxReaders)
+    : name(_name), databaseName(_databaseName), profile(_profile), maxReaders(qMax(1, _maxReaders)), readerSerial(0), counters{0, maxReaders, 0, 0, 0, 0, 0}
+{
+    writerConnection.connectionName = name;
+    QSqlDatabase connection = QSqlDatabase::addDatabase("QSQLITE", name);
+    connection.setDatabaseName(databaseName);
+    if (!connection.open())
+    {
+        qCritical() << "数据库：打开" << databaseName << "失败" << connection.lastError();
+        exit(1);
+    }
+    applyProfile(connection, profile, true, true);
+    qInfo() << "数据库：连接池最多" << maxReaders << "个读连接";
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for (PooledConnection *connection : readers)
+    {
+        QObject::disconnect(connection->finished);
+        close(connection);
+        delete connection;
+    }
+    readers.clear();
+    close(&writerConnection);
+}
+
+void ConnectionPool::close(PooledConnection *connection)
+{
+    for (const QList<QSqlQuery *> &queries : connection->statements)
+        qDeleteAll(queries);
+    connection->statements.clear();
+    {
+        QSqlDatabase database = QSqlDatabase::database(connection->connectionName, false);
+        database.close();
+    }
+    QSqlDatabase::removeDatabase(connection->connectionName);
+}
+
+QSqlDatabase ConnectionPool::writer() const
+{
+    return QSqlDatabase::database(writerConnection.connectionName, false);
+}
+
+ConnectionPool::PooledConnection *ConnectionPool::readerConnection()
+{
+    QMutexLocker locker(&mutex);
+    QThread *thread = QThread::currentThread();
+    auto iter = readers.constFind(thread);
+    if (iter != readers.constEnd())
+    {
+        counters.readerReuses++;
+        return iter.value();
+    }
+
+    while (readers.size() >= maxReaders)
+    {
+        counters.readerWaits++;
+        released.wait(&mutex);
+    }
+    PooledConnection *pooled = new PooledConnection;
+    pooled->connectionName = QString("%1_reader%2").arg(name).arg(++readerSerial);
+    QSqlDatabase connection = QSqlDatabase::addDatabase("QSQLITE", pooled->connectionName);
+    connection.setDatabaseName(databaseName);
+    connection.setConnectOptions("QSQLITE_OPEN_READONLY");
+    if (!connection.open())
+    {
+        //不缓存打开失败的连接，本次的查询执行失败，下次调用时重试
+        qCritical() << "数据库：打开读连接失败" << connection.lastError();
+        connection = QSqlDatabase();
+        QSqlDatabase::removeDatabase(pooled->connectionName);
+        delete pooled;
+        released.wakeOne();
+        return nullptr;
+    }
+    applyProfile(connection, profile, false, false);
+    //线程结束时在该线程中关闭它的连接，槽位不会泄漏，之后在同一地址创建的QThread也不会取得这个连接
+    pooled->finished = QObject::connect(thread, &QThread::finished, thread, [this, thread]()
+                                        { release(thread); }, Qt::DirectConnection);
+    readers.insert(thread, pooled);
+    counters.readerOpens++;
+    return pooled;
+}
+
+QSqlDatabase ConnectionPool::reader()
+{
+    PooledConnection *connection = readerConnection();
+    return connection ? QSqlDatabase::database(connection->connectionName, false) : QSqlDatabase();
+}
+
+void ConnectionPool::releaseThread()
+{
+    release(QThread::currentThread());
+}
+
+void ConnectionPool::release(QThread *thread)
+{
+    QMutexLocker locker(&mutex);
+    PooledConnection *connection = readers.take(thread);
+    if (!connection)
+        return;
+    QObject::disconnect(connection->finished);
+    close(connection);
+    delete connection;
+    released.wakeOne();
+}
+
+QSqlQuery &ConnectionPool::statement(PooledConnection &connection, const QString &key, const std::function<QString()> &build)
+{
+    //一个连接的缓存只被它所属的线程访问，只有统计计数需要加锁
+    //同一线程在遍历结果时重入同一形状的查询时，外层的语句仍在读取，不能复位它
+    QList<QSqlQuery *> &queries = connection.statements[key];
+    QSqlQuery *found = nullptr;
+    for (QSqlQuery *query : queries)
+        if (!query->isActive() || !query->isSelect())
+        {
+            found = query;
+            break;
+        }
+    {
+        QMutexLocker locker(&mutex);
+        (found ? counters.statementHits : counters.statementMiss)++;
+    }
+    if (found)
+        return *found;
+    QString queryString = build();
+    QSqlQuery *sqlQuery = new QSqlQuery(QSqlDatabase::database(connection.connectionName, false));
+    if (!sqlQuery->prepare(queryString))
+        qCritical() << "数据库：语句编译失败" << queryString << sqlQuery->lastError();
+    queries.append(sqlQuery);
+    return *sqlQuery;
+}
+
+QSqlQuery &ConnectionPool::writerQuery(const QString &queryString)
+{
+    return statement(writerConnection, queryString, [&queryString]()
+                     { return queryString; });
+}
+
+QSqlQuery &ConnectionPool::readerQuery(const QString &key, const std::function<QString()> &build)
+{
+    PooledConnection *connection = readerConnection();
+    if (connection)
+        return statement(*connection, key, build);
+    //没有可用的连接，返回本线程的空语句，调用者执行时得到错误
+    static thread_local QSqlQuery unavailable;
+    unavailable = QSqlQuery(QSqlDatabase());
+    return unavailable;
+}
+
+ConnectionPoolStats ConnectionPool::stats() const
+{
+    QMutexLocker locker(&mutex);
+    ConnectionPoolStats result = counters;
+    result.readers = readers.size();
+    return result;
+}
@@ -11,10 +11,43 @@
 
 #include "../include/database.h"
 #include <QDebug>
-#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+#include <algorithm>
 
 using namespace std;
 
+const QString DATABASE_FILE_NAME = "../data/db.sqlite"; //SQLite数据库文件
+
+DatabaseConfig DatabaseConfig::load(const QString &fileName)
+{
+    DatabaseConfig config;
+    QSettings settings(fileName, QSettings::IniFormat);
+    config.userLogCompactThreshold = settings.value("user/logCompactThreshold", config.userLogCompactThreshold).toInt();
+    config.userStorage = settings.value("user/storage", "file").toString() == "sqlite" ? USER_STORAGE_SQLITE : USER_STORAGE_FILE;
+    config.userCommitInterval = settings.value("user/commitInterval", config.userCommitInterval).toInt();
+    config.userCommitBatchSize = settings.value("user/commitBatchSize", config.userCommitBatchSize).toInt();
+    config.userFlushOnAck = settings.value("user/flushOnAck", config.userFlushOnAck).toBool();
+    config.bootSnapshot = settings.value("boot/snapshot", config.bootSnapshot).toBool();
+    config.itemIdBlockSize = settings.value("item/idBlockSize", config.itemIdBlockSize).toInt();
+    config.itemCacheSize = settings.value("item/cacheSize", config.itemCacheSize).toInt();
+    config.archiveAfterDays = settings.value("archive/afterDays", config.archiveAfterDays).toInt();
+    config.itemColumnar = settings.value("item/columnar", config.itemColumnar).toBool();
+
+    //先取预设，再用单独配置的项覆盖
+    QString profileName = settings.value("sqlite/profile", config.sqlite.name).toString();
+    if (!SqliteProfile::preset(profileName, config.sqlite))
+        qWarning() << "配置：不存在SQLite预设" << profileName << "，使用" << config.sqlite.name;
+    config.sqlite.journalMode = settings.value("sqlite/journalMode", config.sqlite.journalMode).toString();
+    config.sqlite.synchronous = settings.value("sqlite/synchronous", config.sqlite.synchronous).toString();
+    config.sqlite.cacheSize = settings.value("sqlite/cacheSize", config.sqlite.cacheSize).toInt();
+    config.sqlite.mmapSize = settings.value("sqlite/mmapSize", config.sqlite.mmapSize).toLongLong();
+    config.sqlite.tempStore = settings.value("sqlite/tempStore", config.sqlite.tempStore).toString();
+    config.sqlite.pageSize = settings.value("sqlite/pageSize", config.sqlite.pageSize).toInt();
+    config.sqliteReaders = settings.value("sqlite/readers", config.sqliteReaders).toInt();
+    return config;
+}
+
 void Database::exec(const QSqlQuery &sqlQuery)
 {
     qDebug() << "执行SQL语句" << sqlQuery.lastQuery();
@@ -23,79 +56,416 @@ void Database::exec(const QSqlQuery &sqlQuery)
         qDebug() << i.key().toUtf8().data() << ":" << i.value().toString().toUtf8().data();
 }
 
-//由于user信息改为文件存储，数据库中只有一个表了，保留以做拓展性。
+//user信息默认使用文件存储，配置为sqlite存储时才会用到user表。
 const QString &Database::getPrimaryKeyByTableName(const QString &tableName)
 {
-    // static QString username("username");
+    static QString username("username");
     static QString id("id");
-    // if (tableName == "user")
-    //     return username;
-    // else
-    return id;
+    if (tableName == "user")
+        return username;
+    else
+        return id;
 }
 
-Database::Database(const QString &connectionName, const QString &fileName) : userFileName(fileName), usernameSet()
+Database::Database(const QString &connectionName, const QString &fileName, const DatabaseConfig &_config) : usernameSet(), userFileName(fileName), config(_config), userLog(fileName, _config.userLogCompactThreshold), itemSearchAvailable(false), itemSearchMinTerm(1), archive(QFileInfo(DATABASE_FILE_NAME).path() + "/archive"), itemChanges(0)
 {
-    db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
-    db.setDatabaseName("../data/db.sqlite");
-    db.open();
+    snapshotFileName = QFileInfo(fileName).path() + "/boot.snapshot";
+
+    //载入用户与打开数据库、检查表同时进行
+    BootSnapshot snapshot;
+    bool snapshotValid = false, usersLoaded = false;
+    //在打开数据库之前读取快照依赖的文件的状态，打开数据库会新建-wal文件
+    QVector<FileStamp> watchedStamps;
+    for (const QString &watched : snapshotWatchedFiles())
+        watchedStamps.append(FileStamp::of(watched));
+    QThread *loader = QThread::create([&]()
+                                      {
+                                          snapshotValid = config.bootSnapshot && BootSnapshot::load(snapshotFileName, watchedStamps, snapshot) && snapshot.userStorage == config.userStorage;
+                                          usersLoaded = loadUsers(snapshotValid ? &snapshot : nullptr); });
+    loader->start();
+
+    pool.reset(new ConnectionPool(connectionName, DATABASE_FILE_NAME, config.sqlite, config.sqliteReaders));
+    db = pool->writer();
 
     if (!db.tables().contains("item")) //若不包含item，则创建。
     {
-        QSqlQuery sqlQuery(db);
-        sqlQuery.prepare("CREATE TABLE item( id INT PRIMARY KEY NOT NULL,"
-                         "cost INT NOT NULL,"
-                         "type INT NOT NULL,"
-                         "state INT NOT NULL,"
-                         "sendingTime_Year INT NOT NULL,"
-                         "sendingTime_Month INT NOT NULL,"
-                         "sendingTime_Day INT NOT NULL,"
-                         "receivingTime_Year INT NOT NULL,"
-                         "receivingTime_Month INT NOT NULL,"
-                         "receivingTime_Day INT NOT NULL,"
-                         "srcName TEXT NOT NULL,"
-                         "dstName TEXT NOT NULL,"
-                         "expressman TEXT NOT NULL,"
-                         "description TEXT NOT NULL) ");
-
-        exec(sqlQuery);
-        if (!sqlQuery.exec())
-            qCritical() << "item表创建失败" << sqlQuery.lastError();
-        else
+        if (createItemTable("item"))
             qDebug() << "item表创建成功";
     }
     else
         qDebug() << "item表已存在";
+    migrateItemDates();
+    createItemIndexes();
+    itemSearchAvailable = createItemSearchIndex();
+    archive.load();
 
-    QFile userFile(userFileName);
-    if (!userFile.open(QIODevice::ReadWrite | QIODevice ::Text))
+    //物品id的高水位，多个写者通过它租用互不重叠的id段
+    {
+        QSqlQuery sqlQuery(db);
+        if (!sqlQuery.exec("CREATE TABLE IF NOT EXISTS item_id( name TEXT PRIMARY KEY NOT NULL, highWater INT NOT NULL)") ||
+            !sqlQuery.exec("INSERT OR IGNORE INTO item_id SELECT 'item', IFNULL(MAX(id), 0) FROM item"))
+        {
+            qCritical() << "数据库：创建item_id表失败" << sqlQuery.lastError();
+            exit(1);
+        }
+    }
+    itemIds.reset(new ItemIdAllocator([connectionName](int count, int &first)
+                                      { return leaseItemIds(connectionName, count, first); },
+                                      [connectionName](int next, int last)
+                                      { giveBackItemIds(connectionName, next, last); },
+                                      config.itemIdBlockSize));
+
+    loader->wait();
+    delete loader;
+    if (!usersLoaded)
     {
         qCritical() << "user文件打开失败";
         exit(1);
     }
 
-    QTextStream stream;
-    bool isAdministratorExist = false;
-    stream.setDevice(&userFile);
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
-    while (!stream.atEnd())
+    if (config.userStorage == USER_STORAGE_SQLITE && !snapshotValid)
     {
-        stream >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream >> ch;
-        usernameSet.insert(username);
-        if (username == "admin")
-            isAdministratorExist = true;
+        if (!db.tables().contains("user")) //若不包含user，则创建并从用户文件导入。
+        {
+            QSqlQuery sqlQuery(db);
+            sqlQuery.prepare("CREATE TABLE user( username TEXT PRIMARY KEY NOT NULL,"
+                             "password TEXT NOT NULL,"
+                             "type INT NOT NULL,"
+                             "balance INT NOT NULL,"
+                             "name TEXT NOT NULL,"
+                             "phoneNumber TEXT NOT NULL,"
+                             "address TEXT NOT NULL) ");
+
+            exec(sqlQuery);
+            if (!sqlQuery.exec())
+            {
+                qCritical() << "user表创建失败" << sqlQuery.lastError();
+                exit(1);
+            }
+            qDebug() << "user表创建成功";
+            importUsersFromFile(userFileName);
+        }
+        else
+            qDebug() << "user表已存在";
+
+        QSqlQuery sqlQuery(db);
+        sqlQuery.prepare("SELECT username FROM user");
+        exec(sqlQuery);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "数据库:读取用户名失败" << sqlQuery.lastError();
+            exit(1);
+        }
+        while (sqlQuery.next())
+            usernameSet.insert(sqlQuery.value(0).toString());
+        qDebug() << "数据库：载入" << usernameSet.size() << "个用户名";
     }
-    if (!isAdministratorExist)
+
+    //组提交的写线程在sqlite存储时使用自己的连接
+    QString commitConnectionName = connectionName + "_userCommit";
+    int userStorage = config.userStorage;
+    SqliteProfile sqliteProfile = config.sqlite;
+    UserLog *log = &userLog;
+    userCommit.reset(new UserCommitQueue(
+        [=](const QList<UserChange> &changes)
+        {
+            if (userStorage != USER_STORAGE_SQLITE)
+                return log->appendChanges(changes);
+            if (!QSqlDatabase::contains(commitConnectionName))
+            {
+                QSqlDatabase connection = QSqlDatabase::addDatabase("QSQLITE", commitConnectionName);
+                connection.setDatabaseName(DATABASE_FILE_NAME);
+                connection.open();
+                ConnectionPool::applyProfile(connection, sqliteProfile, true, false);
+            }
+            QSqlDatabase connection = QSqlDatabase::database(commitConnectionName);
+            return writeUserChanges(connection, changes);
+        },
+        [=]()
+        {
+            if (QSqlDatabase::contains(commitConnectionName))
+            {
+                QSqlDatabase::database(commitConnectionName).close();
+                QSqlDatabase::removeDatabase(commitConnectionName);
+            }
+        },
+        config.userCommitInterval, config.userCommitBatchSize, config.userFlushOnAck));
+
+    if (!usernameSet.contains("admin"))
         insertUser("admin", "123", ADMINISTRATOR, 0, "管理员", "88888888", "环宇物流大厦");
 }
 
-bool Database::modifyData(const QString &tableName, const QString &primaryKey, const QString &key, int value) const
+Database::~Database()
+{
+    //先写完所有待写的用户变更
+    userCommit.reset();
+    userLog.waitForCompaction();
+    qInfo() << "数据库：本次共租用" << itemIds->leaseCount() << "段物品id";
+    itemIds.reset();
+    ConnectionPoolStats stats = pool->stats();
+    qInfo() << "数据库：连接池打开" << stats.readerOpens << "个读连接，等待" << stats.readerWaits << "次，语句缓存命中" << stats.statementHits << "次，未命中" << stats.statementMiss << "次";
+    qInfo() << "数据库：符号表共" << SymbolTable::instance().size() << "个用户名";
+    db = QSqlDatabase();
+    pool.reset();
+    if (!config.bootSnapshot)
+        return;
+
+    BootSnapshot snapshot;
+    snapshot.userStorage = config.userStorage;
+    if (config.userStorage == USER_STORAGE_SQLITE)
+        snapshot.usernames = usernameSet;
+    else
+    {
+        snapshot.userLogCount = userLog.count();
+        snapshot.users.reserve(userIndex.size());
+        for (auto i = userIndex.constBegin(); i != userIndex.constEnd(); i++)
+            snapshot.users.insert(i.key(), userLog.resolve(i.value()));
+    }
+    snapshot.save(snapshotFileName, snapshotWatchedFiles());
+}
+
+bool Database::createItemSearchIndex()
 {
     QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("UPDATE " + tableName + " SET " + key + " = :value WHERE " + getPrimaryKeyByTableName(tableName) + " = :primaryKey");
+    bool created = false;
+    if (!db.tables().contains("item_fts"))
+    {
+        //trigram分词需要SQLite 3.34，不支持时退回默认分词
+        if (!sqlQuery.exec("CREATE VIRTUAL TABLE item_fts USING fts5(description, tokenize = 'trigram')") &&
+            !sqlQuery.exec("CREATE VIRTUAL TABLE item_fts USING fts5(description)"))
+        {
+            qWarning() << "数据库：SQLite不支持FTS5，物品搜索不可用" << sqlQuery.lastError();
+            return false;
+        }
+        created = true;
+    }
+    if (sqlQuery.exec("SELECT sql FROM sqlite_master WHERE name = 'item_fts'") && sqlQuery.next() && sqlQuery.value(0).toString().contains("trigram"))
+        itemSearchMinTerm = 3;
+
+    //rowid即物品id。触发器与item表的修改在同一语句中执行，索引不会与item表不一致；item表被迁移重建后触发器随之删除，这里重新创建
+    static const char *triggers[] = {
+        "CREATE TRIGGER IF NOT EXISTS item_fts_insert AFTER INSERT ON item BEGIN"
+        " INSERT INTO item_fts(rowid, description) VALUES (new.id, new.description); END",
+        "CREATE TRIGGER IF NOT EXISTS item_fts_delete AFTER DELETE ON item BEGIN"
+        " DELETE FROM item_fts WHERE rowid = old.id; END",
+        "CREATE TRIGGER IF NOT EXISTS item_fts_update AFTER UPDATE OF description ON item BEGIN"
+        " UPDATE item_fts SET description = new.description WHERE rowid = old.id; END",
+    };
+    for (const char *trigger : triggers)
+        if (!sqlQuery.exec(trigger))
+        {
+            qCritical() << "数据库：创建全文索引触发器失败" << sqlQuery.lastError();
+            return false;
+        }
+
+    if (created)
+    {
+        qInfo() << "数据库：为物品描述建立全文索引";
+        if (!sqlQuery.exec("INSERT INTO item_fts(rowid, description) SELECT id, description FROM item"))
+            qCritical() << "数据库：回填全文索引失败" << sqlQuery.lastError();
+    }
+    return true;
+}
+
+bool Database::createItemTable(const QString &tableName)
+{
+    QSqlQuery sqlQuery(db);
+    sqlQuery.prepare("CREATE TABLE " + tableName + "( id INT PRIMARY KEY NOT NULL,"
+                     "cost INT NOT NULL,"
+                     "type INT NOT NULL,"
+                     "state INT NOT NULL,"
+                     "sendingDay INT NOT NULL,"
+                     "receivingDay INT NOT NULL,"
+                     "srcName TEXT NOT NULL,"
+                     "dstName TEXT NOT NULL,"
+                     "expressman TEXT NOT NULL,"
+                     "description TEXT NOT NULL) ");
+
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << tableName << "表创建失败" << sqlQuery.lastError();
+        return false;
+    }
+    return true;
+}
+
+const int ITEM_MIGRATION_BATCH = 10000; //迁移item表时每个事务复制的行数
+
+void Database::migrateItemDates()
+{
+    if (!db.record("item").contains("sendingTime_Year"))
+        return;
+
+    //旧表按日期的年、月、日分三列存储。逐批复制到新表，每批一个事务，中断后从新表中已有的最大id继续
+    if (!db.tables().contains("item_migrating") && !createItemTable("item_migrating"))
+        exit(1);
+    qInfo() << "数据库：开始把item表的日期迁移为日期键";
+
+    QSqlQuery sqlQuery(db);
+    sqlQuery.prepare("INSERT INTO item_migrating SELECT id, cost, type, state,"
+                     " CASE WHEN sendingTime_Year < 0 THEN -1 ELSE sendingTime_Year * 10000 + sendingTime_Month * 100 + sendingTime_Day END,"
+                     " CASE WHEN receivingTime_Year < 0 THEN -1 ELSE receivingTime_Year * 10000 + receivingTime_Month * 100 + receivingTime_Day END,"
+                     " srcName, dstName, expressman, description"
+                     " FROM item WHERE id > (SELECT IFNULL(MAX(id), -1) FROM item_migrating) ORDER BY id LIMIT :batch");
+    int total = 0;
+    while (true)
+    {
+        db.transaction();
+        sqlQuery.bindValue(":batch", ITEM_MIGRATION_BATCH);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "数据库：迁移item表失败" << sqlQuery.lastError();
+            db.rollback();
+            exit(1);
+        }
+        int rows = sqlQuery.numRowsAffected();
+        db.commit();
+        if (rows <= 0)
+            break;
+        total += rows;
+        qInfo() << "数据库：已迁移" << total << "个物品";
+    }
+
+    //最后一步在同一个事务中替换旧表，旧表上的索引随之删除，由createItemIndexes重建
+    db.transaction();
+    QSqlQuery swapQuery(db);
+    if (!swapQuery.exec("DROP TABLE item") || !swapQuery.exec("ALTER TABLE item_migrating RENAME TO item"))
+    {
+        qCritical() << "数据库：替换item表失败" << swapQuery.lastError();
+        db.rollback();
+        exit(1);
+    }
+    db.commit();
+    qInfo() << "数据库：item表迁移完成，共" << total << "个物品";
+}
+
+void Database::createItemIndexes()
+{
+    //与queryItemByFilter的实际访问路径对应：查寄出、收到、派送的物品时总带有用户名，常再加上状态；日期按范围查询
+    static const char *indexes[][2] = {
+        {"item_srcName_state", "srcName, state"},
+        {"item_dstName_state", "dstName, state"},
+        {"item_expressman_state", "expressman, state"},
+        {"item_state", "state"},
+        {"item_sendingDay_id", "sendingDay, id"},
+        {"item_receivingDay", "receivingDay"},
+    };
+
+    QStringList existing;
+    QSqlQuery listQuery(db);
+    if (listQuery.exec("SELECT name FROM sqlite_master WHERE type = 'index' AND tbl_name = 'item'"))
+        while (listQuery.next())
+            existing.append(listQuery.value(0).toString());
+
+    for (auto &index : indexes)
+    {
+        if (existing.contains(index[0]))
+            continue;
+        //旧数据库第一次打开时建索引，表很大时需要一段时间
+        qInfo() << "数据库：为item表创建索引" << index[0];
+        QSqlQuery sqlQuery(db);
+        sqlQuery.prepare(QString("CREATE INDEX IF NOT EXISTS %1 ON item(%2)").arg(index[0], index[1]));
+        exec(sqlQuery);
+        if (!sqlQuery.exec())
+            qCritical() << "数据库：创建索引" << index[0] << "失败" << sqlQuery.lastError();
+    }
+}
+
+QStringList Database::snapshotWatchedFiles() const
+{
+    //WAL模式下未检查点的修改只在-wal文件中，正常关闭时该文件会被删除
+    return userLog.fileNames() << DATABASE_FILE_NAME << DATABASE_FILE_NAME + "-wal";
+}
+
+bool Database::loadUsers(const BootSnapshot *snapshot)
+{
+    if (config.userStorage == USER_STORAGE_SQLITE)
+    {
+        if (snapshot)
+            usernameSet = snapshot->usernames;
+        return true;
+    }
+
+    if (snapshot)
+    {
+        userIndex = snapshot->users;
+        userLog.resume(snapshot->userLogCount);
+    }
+    else if (!userLog.load(userIndex))
+        return false;
+    usernameSet.reserve(userIndex.size());
+    for (auto i = userIndex.constBegin(); i != userIndex.constEnd(); i++)
+        usernameSet.insert(i.key());
+    qDebug() << "文件：载入" << userIndex.size() << "个用户";
+    return true;
+}
+
+int Database::allocateItemIds(int count)
+{
+    return itemIds->allocate(count);
+}
+
+//租用和归还很少发生，每次临时打开一个属于调用线程的连接，不占用连接池
+static QSqlDatabase openLeaseConnection(const QString &connectionName)
+{
+    QSqlDatabase connection = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    connection.setDatabaseName(DATABASE_FILE_NAME);
+    connection.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+    if (!connection.open())
+        qCritical() << "数据库：打开" << connectionName << "失败" << connection.lastError();
+    return connection;
+}
+
+bool Database::leaseItemIds(const QString &connectionName, int count, int &first)
+{
+    QString leaseConnectionName = connectionName + "_itemId" + QString::number(quintptr(QThread::currentThread()));
+    bool ok = false;
+    {
+        QSqlDatabase connection = openLeaseConnection(leaseConnectionName);
+        QSqlQuery sqlQuery(connection);
+        //先写后读，事务一开始就持有写锁，其他写者在这里排队
+        connection.transaction();
+        sqlQuery.prepare("UPDATE item_id SET highWater = MAX(highWater, (SELECT IFNULL(MAX(id), 0) FROM item)) + :count WHERE name = 'item'");
+        sqlQuery.bindValue(":count", count);
+        if (sqlQuery.exec() && sqlQuery.exec("SELECT highWater FROM item_id WHERE name = 'item'") && sqlQuery.next())
+        {
+            first = sqlQuery.value(0).toInt() - count + 1;
+            ok = connection.commit();
+        }
+        if (!ok)
+        {
+            qCritical() << "数据库：租用物品id失败" << sqlQuery.lastError();
+            connection.rollback();
+        }
+        sqlQuery.finish();
+        connection.close();
+    }
+    QSqlDatabase::removeDatabase(leaseConnectionName);
+    if (ok)
+        qDebug() << "数据库：租用物品id" << first << "~" << first + count - 1;
+    return ok;
+}
+
+void Database::giveBackItemIds(const QString &connectionName, int next, int last)
+{
+    QString leaseConnectionName = connectionName + "_itemId" + QString::number(quintptr(QThread::currentThread()));
+    {
+        QSqlDatabase connection = openLeaseConnection(leaseConnectionName);
+        QSqlQuery sqlQuery(connection);
+        sqlQuery.prepare("UPDATE item_id SET highWater = :highWater WHERE name = 'item' AND highWater = :last");
+        sqlQuery.bindValue(":highWater", next - 1);
+        sqlQuery.bindValue(":last", last);
+        if (!sqlQuery.exec())
+            qWarning() << "数据库：归还物品id失败" << sqlQuery.lastError();
+        connection.close();
+    }
+    QSqlDatabase::removeDatabase(leaseConnectionName);
+}
+
+bool Database::modifyData(const QString &tableName, const QString &primaryKey, const QString &key, int value) const
+{
+    QSqlQuery &sqlQuery = pool->writerQuery("UPDATE " + tableName + " SET " + key + " = :value WHERE " + getPrimaryKeyByTableName(tableName) + " = :primaryKey");
     sqlQuery.bindValue(":value", value);
     sqlQuery.bindValue(":primaryKey", primaryKey);
 
@@ -118,8 +488,7 @@ bool Database::modifyData(const QString &tableName, const QString &primaryKey, c
 
 bool Database::modifyData(const QString &tableName, const QString &primaryKey, const QString &key, const QString value) const
 {
-    QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("UPDATE " + tableName + " SET " + key + " = :value WHERE " + getPrimaryKeyByTableName(tableName) + " = :primaryKey");
+    QSqlQuery &sqlQuery = pool->writerQuery("UPDATE " + tableName + " SET " + key + " = :value WHERE " + getPrimaryKeyByTableName(tableName) + " = :primaryKey");
     sqlQuery.bindValue(":value", value);
     sqlQuery.bindValue(":primaryKey", primaryKey);
 
@@ -140,148 +509,267 @@ bool Database::modifyData(const QString &tableName, const QString &primaryKey, c
     }
 }
 
-void Database::insertUser(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address)
+bool Database::commitUsers(const QList<UserChange> &changes)
 {
-    if (!usernameSet.contains(username))
+    //先更新内存中的用户名集合和索引，写入失败时恢复为提交前的状态
+    bool fileStorage = config.userStorage != USER_STORAGE_SQLITE;
+    QSet<QString> touched, existed;
+    QHash<QString, UserRecord> previous;
+    for (const UserChange &change : changes)
     {
-        qDebug() << "文件：插入user " << username << " 成功";
-        usernameSet.insert(username);
-        QFile userFile(userFileName);
-        if (!userFile.open(QIODevice::ReadWrite | QIODevice ::Text))
+        if (!touched.contains(change.username))
         {
-            qCritical() << "user文件打开失败";
-            exit(1);
+            touched.insert(change.username);
+            if (usernameSet.contains(change.username))
+                existed.insert(change.username);
+            auto iter = userIndex.constFind(change.username);
+            if (fileStorage && iter != userIndex.constEnd())
+                previous.insert(change.username, iter.value());
         }
-        QTextStream stream(&userFile);
+        if (change.deleted)
+        {
+            usernameSet.remove(change.username);
+            if (fileStorage)
+                userIndex.remove(change.username);
+        }
+        else
+        {
+            usernameSet.insert(change.username);
+            if (fileStorage)
+                userIndex.insert(change.username, change.record);
+        }
+    }
 
-        int tempType, tempBalance;
-        QString tempUsername, tempPassword, tempName, tempPhoneNumber, tempAddress;
-        char ch;
-        while (!stream.atEnd())
+    if (!userCommit->submit(changes))
+    {
+        for (const QString &username : touched)
         {
-            stream >> tempUsername >> tempPassword >> tempType >> tempType >> tempName >> tempPhoneNumber >> tempAddress;
-            stream >> ch;
+            if (existed.contains(username))
+                usernameSet.insert(username);
+            else
+                usernameSet.remove(username);
+            if (!fileStorage)
+                continue;
+            auto iter = previous.constFind(username);
+            if (iter != previous.constEnd())
+                userIndex.insert(username, iter.value());
+            else
+                userIndex.remove(username);
         }
-        qDebug() << username << password << type << balance << name << phoneNumber << address;
-        stream << username << " " << password << " " << type << " " << balance << " " << name << " " << phoneNumber << " " << address << Qt::endl;
-        userFile.close();
+        qCritical() << "数据库：用户变更写入失败，已恢复" << touched.size() << "个用户";
+        return false;
     }
-    else
-        qCritical() << "文件：插入user " << username << "失败"
-                    << "该用户已存在文件中";
+    if (fileStorage && userLog.needsCompaction())
+        userLog.compact(userIndex);
+    return true;
 }
 
-QSharedPointer<User> Database::queryUserByName(const QString &targetUsername) const
+bool Database::writeUserChanges(QSqlDatabase &connection, const QList<UserChange> &changes)
 {
-    QFile userFile(userFileName);
-    if (!userFile.open(QIODevice::ReadWrite | QIODevice ::Text))
-    {
-        qCritical() << "user文件打开失败";
-        exit(1);
-    }
-    QTextStream stream(&userFile);
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
+    QSqlQuery upsertQuery(connection), deleteQuery(connection);
+    upsertQuery.prepare("INSERT OR REPLACE INTO user VALUES(:username, :password, :type, :balance, :name, :phoneNumber, :address)");
+    deleteQuery.prepare("DELETE FROM user WHERE username = :username");
 
-    while (!stream.atEnd())
+    //一批变更在同一个事务中写入
+    connection.transaction();
+    for (const UserChange &change : changes)
     {
-        stream >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream >> ch;
-        if (username == targetUsername)
+        bool ok;
+        if (change.deleted)
+        {
+            deleteQuery.bindValue(":username", change.username);
+            ok = deleteQuery.exec();
+        }
+        else
         {
-            userFile.close();
-            return query2User(username, password, type, balance, name, phoneNumber, address);
+            upsertQuery.bindValue(":username", change.username);
+            upsertQuery.bindValue(":password", change.record.password);
+            upsertQuery.bindValue(":type", change.record.type);
+            upsertQuery.bindValue(":balance", change.record.balance);
+            upsertQuery.bindValue(":name", change.record.name);
+            upsertQuery.bindValue(":phoneNumber", change.record.phoneNumber);
+            upsertQuery.bindValue(":address", change.record.address);
+            ok = upsertQuery.exec();
+        }
+        if (!ok)
+        {
+            qCritical() << "数据库:写入用户 " << change.username << " 失败" << (change.deleted ? deleteQuery.lastError() : upsertQuery.lastError());
+            connection.rollback();
+            return false;
         }
     }
-    return NULL;
+    qDebug() << "数据库:组提交写入" << changes.size() << "个用户变更";
+    return connection.commit();
 }
 
-int Database::queryBalanceByName(const QString &username) const
+int Database::importUsersFromFile(const QString &fileName)
 {
-    QSharedPointer<User> user = queryUserByName(username);
-    if (user)
-        return user->getBalance();
-    else
-        return -1;
+    QHash<QString, UserRecord> records;
+    UserLog fileLog(fileName, config.userLogCompactThreshold);
+    if (!fileLog.load(records, false))
+    {
+        qWarning() << "文件：" << fileName << "不存在，跳过导入";
+        return 0;
+    }
+
+    db.transaction();
+    QSqlQuery sqlQuery(db);
+    sqlQuery.prepare("INSERT OR IGNORE INTO user VALUES(:username, :password, :type, :balance, :name, :phoneNumber, :address)");
+    int cnt = 0;
+    for (auto i = records.constBegin(); i != records.constEnd(); i++)
+    {
+        UserRecord record = fileLog.resolve(i.value());
+        sqlQuery.bindValue(":username", i.key());
+        sqlQuery.bindValue(":password", record.password);
+        sqlQuery.bindValue(":type", record.type);
+        sqlQuery.bindValue(":balance", record.balance);
+        sqlQuery.bindValue(":name", record.name);
+        sqlQuery.bindValue(":phoneNumber", record.phoneNumber);
+        sqlQuery.bindValue(":address", record.address);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "数据库:导入用户 " << i.key() << " 失败" << sqlQuery.lastError();
+            db.rollback();
+            return 0;
+        }
+        cnt += sqlQuery.numRowsAffected();
+    }
+    db.commit();
+    qInfo() << "数据库：从" << fileName << "导入" << cnt << "个用户";
+    return cnt;
 }
 
-bool Database::modifyUserPassword(const QString &targetUsername, const QString &targetPassword) const
+bool Database::queryUserRecord(const QString &username, UserRecord &record) const
 {
-    if (!usernameSet.contains(targetUsername))
-        return false;
-
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
-    QFile userFile1(userFileName), userFile2("../data/tempUsers.txt");
-    if (!userFile1.open(QIODevice::ReadWrite | QIODevice ::Text))
+    UserChange change;
+    if (userCommit && userCommit->pending(username, change))
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        //尚未写入user表的变更以队列中的为准
+        if (change.deleted)
+            return false;
+        record = change.record;
+        return true;
     }
-    if (!userFile2.open(QIODevice::ReadWrite | QIODevice ::Text))
+
+    if (config.userStorage != USER_STORAGE_SQLITE)
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        auto iter = userIndex.constFind(username);
+        if (iter == userIndex.constEnd())
+            return false;
+        record = userLog.resolve(iter.value());
+        return true;
     }
-    QTextStream stream1(&userFile1);
-    QTextStream stream2(&userFile2);
 
-    while (!stream1.atEnd())
+    QSqlQuery sqlQuery(db);
+    sqlQuery.prepare("SELECT * FROM user WHERE username = :username");
+    sqlQuery.bindValue(":username", username);
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
     {
-        stream1 >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream1 >> ch; //吃一个回车
-        qDebug() << username << password << type << balance << name << phoneNumber << address;
-        if (username == targetUsername)
-            password = targetPassword;
-        stream2 << username << " " << password << " " << type << " " << balance << " " << name << " " << phoneNumber << " " << address << Qt::endl;
+        qCritical() << "数据库:查找用户失败" << sqlQuery.lastError();
+        return false;
     }
-    userFile1.close();
-    userFile2.close();
-    QDir dir;
-    dir.remove(userFileName);
-    dir.rename("../data/tempUsers.txt", userFileName);
+    if (!sqlQuery.next())
+        return false;
+    record = UserRecord{sqlQuery.value(1).toString(), sqlQuery.value(2).toInt(), sqlQuery.value(3).toInt(), sqlQuery.value(4).toString(), sqlQuery.value(5).toString(), sqlQuery.value(6).toString()};
     return true;
 }
 
-bool Database::modifyUserBalance(const QString &targetUsername, int targetBalance) const
+bool Database::insertUser(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address)
 {
-    if (!usernameSet.contains(targetUsername))
+    if (usernameSet.contains(username))
+    {
+        qCritical() << "插入user " << username << "失败"
+                    << "该用户已存在";
         return false;
+    }
+
+    qDebug() << username << password << type << balance << name << phoneNumber << address;
+    UserRecord record{password, type, balance, name, phoneNumber, address};
+    if (!commitUsers({UserChange{username, false, record}}))
+        return false;
+    qDebug() << "插入user " << username << " 成功";
+    return true;
+}
 
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
-    QFile userFile1(userFileName), userFile2("../data/tempUsers.txt");
-    if (!userFile1.open(QIODevice::ReadWrite | QIODevice ::Text))
+int Database::insertUsers(const QList<QPair<QString, UserRecord>> &users, QMap<int, QString> &failures)
+{
+    QList<UserChange> changes;
+    QSet<QString> batchNames;
+    for (int i = 0; i < users.size(); i++)
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        const QString &username = users[i].first;
+        if (usernameSet.contains(username))
+            failures.insert(i, "该用户名已被注册");
+        else if (batchNames.contains(username))
+            failures.insert(i, "该用户名在本批中重复");
+        else
+        {
+            batchNames.insert(username);
+            changes.append(UserChange{username, false, users[i].second});
+        }
     }
-    if (!userFile2.open(QIODevice::ReadWrite | QIODevice ::Text))
+
+    //整批一次提交，写入时合并为一次追加或一个事务；写入失败时整批都未注册
+    if (!changes.isEmpty() && !commitUsers(changes))
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        for (int i = 0; i < users.size(); i++)
+            if (!failures.contains(i))
+                failures.insert(i, "写入失败");
+        return 0;
     }
-    QTextStream stream1(&userFile1);
-    QTextStream stream2(&userFile2);
+    qDebug() << "批量插入user成功" << changes.size() << "个，失败" << failures.size() << "个";
+    return changes.size();
+}
+
+QSharedPointer<User> Database::queryUserByName(const QString &targetUsername) const
+{
+    UserRecord record;
+    if (!queryUserRecord(targetUsername, record))
+        return NULL;
+    return query2User(targetUsername, record.password, record.type, record.balance, record.name, record.phoneNumber, record.address);
+}
+
+int Database::queryBalanceByName(const QString &username) const
+{
+    UserRecord record;
+    if (queryUserRecord(username, record))
+        return record.balance;
+    else
+        return -1;
+}
 
-    while (!stream1.atEnd())
+bool Database::modifyUserPassword(const QString &targetUsername, const QString &targetPassword)
+{
+    UserRecord record;
+    if (!usernameSet.contains(targetUsername) || !queryUserRecord(targetUsername, record))
+        return false;
+
+    record.password = targetPassword;
+    return commitUsers({UserChange{targetUsername, false, record}});
+}
+
+bool Database::modifyUserBalance(const QString &targetUsername, int targetBalance)
+{
+    QMap<QString, int> balances;
+    balances.insert(targetUsername, targetBalance);
+    return modifyUserBalances(balances);
+}
+
+bool Database::modifyUserBalances(const QMap<QString, int> &balances)
+{
+    QList<UserChange> changes;
+    for (auto i = balances.constBegin(); i != balances.constEnd(); i++)
     {
-        stream1 >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream1 >> ch; //吃一个回车
-        qDebug() << username << password << type << balance << name << phoneNumber << address;
-        if (username == targetUsername)
-            balance = targetBalance;
-        stream2 << username << " " << password << " " << type << " " << balance << " " << name << " " << phoneNumber << " " << address << Qt::endl;
+        UserRecord record;
+        if (!usernameSet.contains(i.key()) || !queryUserRecord(i.key(), record))
+            return false;
+        record.balance = i.value();
+        changes.append(UserChange{i.key(), false, record});
     }
-    userFile1.close();
-    userFile2.close();
-    QDir dir;
-    dir.remove(userFileName);
-    dir.rename("../data/tempUsers.txt", userFileName);
-    return true;
+
+    //同一次提交的变更总在同一批中写入，sqlite存储时在同一个事务中
+    return commitUsers(changes);
 }
 
 int Database::getDBMaxId(const QString &tableName) const
@@ -306,21 +794,14 @@ int Database::getDBMaxId(const QString &tableName) const
 
 void Database::insertItem(int id, int cost, int type, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description)
 {
-    QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("INSERT INTO item VALUES(:id, :cost, :type, :state,"
-                     " :sendingTime_Year, :sendingTime_Month, :sendingTime_Day,"
-                     " :receivingTime_Year, :receivingTime_Month, :receivingTime_Day,"
-                     " :srcName, :dstName, :expressman, :description)");
+    QSqlQuery &sqlQuery = pool->writerQuery("INSERT INTO item VALUES(:id, :cost, :type, :state, :sendingDay, :receivingDay,"
+                                      " :srcName, :dstName, :expressman, :description)");
     sqlQuery.bindValue(":id", id);
     sqlQuery.bindValue(":cost", cost);
     sqlQuery.bindValue(":type", type);
     sqlQuery.bindValue(":state", state);
-    sqlQuery.bindValue(":sendingTime_Year", sendingTime.year);
-    sqlQuery.bindValue(":sendingTime_Month", sendingTime.month);
-    sqlQuery.bindValue(":sendingTime_Day", sendingTime.day);
-    sqlQuery.bindValue(":receivingTime_Year", receivingTime.year);
-    sqlQuery.bindValue(":receivingTime_Month", receivingTime.month);
-    sqlQuery.bindValue(":receivingTime_Day", receivingTime.day);
+    sqlQuery.bindValue(":sendingDay", sendingTime.toDayKey());
+    sqlQuery.bindValue(":receivingDay", receivingTime.toDayKey());
     sqlQuery.bindValue(":srcName", srcName);
     sqlQuery.bindValue(":dstName", dstName);
     sqlQuery.bindValue(":expressman", expressman);
@@ -332,7 +813,42 @@ void Database::insertItem(int id, int cost, int type, int state, const Time &sen
         qDebug() << "数据库:插入id为 " << id << " 的物品项成功 ";
 }
 
-QSharedPointer<User> Database::query2User(const QString &username, QString &password, int &type, int &balance, QString &name, QString &phoneNumber, QString &address) const
+bool Database::insertItems(int firstId, const QVector<ItemSpec> &specs)
+{
+    QSqlQuery &sqlQuery = pool->writerQuery("INSERT INTO item VALUES(:id, :cost, :type, :state, :sendingDay, :receivingDay,"
+                                      " :srcName, :dstName, :expressman, :description)");
+    db.transaction();
+    for (int i = 0; i < specs.size(); i++)
+    {
+        const ItemSpec &spec = specs[i];
+        sqlQuery.bindValue(":id", firstId + i);
+        sqlQuery.bindValue(":cost", spec.cost);
+        sqlQuery.bindValue(":type", spec.type);
+        sqlQuery.bindValue(":state", spec.state);
+        sqlQuery.bindValue(":sendingDay", spec.sendingTime.toDayKey());
+        sqlQuery.bindValue(":receivingDay", spec.receivingTime.toDayKey());
+        sqlQuery.bindValue(":srcName", spec.srcName);
+        sqlQuery.bindValue(":dstName", spec.dstName);
+        sqlQuery.bindValue(":expressman", spec.expressman);
+        sqlQuery.bindValue(":description", spec.description);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "数据库:批量插入id为 " << firstId + i << " 的物品项失败 " << sqlQuery.lastError();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit())
+    {
+        qCritical() << "数据库:批量插入物品提交失败" << db.lastError();
+        db.rollback();
+        return false;
+    }
+    qDebug() << "数据库:批量插入id为 " << firstId << "~" << firstId + specs.size() - 1 << " 的物品项成功 ";
+    return true;
+}
+
+QSharedPointer<User> Database::query2User(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address) const
 {
     QSharedPointer<User> result;
     switch (type)
@@ -350,22 +866,47 @@ QSharedPointer<User> Database::query2User(const QString &username, QString &pass
     return result;
 }
 
-QSharedPointer<Item> Database::query2Item(const QSqlQuery &sqlQuery) const
+QSharedPointer<Item> Database::query2Item(const QSqlQuery &sqlQuery, const int columns) const
 {
-    Time sendingTime{sqlQuery.value(4).toInt(), sqlQuery.value(5).toInt(), sqlQuery.value(6).toInt()};
-    Time receivingTime{sqlQuery.value(7).toInt(), sqlQuery.value(8).toInt(), sqlQuery.value(9).toInt()};
+    Time sendingTime = Time::fromDayKey(sqlQuery.value(4).toInt());
+    Time receivingTime = Time::fromDayKey(sqlQuery.value(5).toInt());
 
     QSharedPointer<Item> result;
     switch (sqlQuery.value(2).toInt())
     {
     case FRAGILE:
-        result = QSharedPointer<FragileItem>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(10).toString(), sqlQuery.value(11).toString(), sqlQuery.value(12).toString(), sqlQuery.value(13).toString());
+        result = QSharedPointer<FragileItem>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(6).toString(), sqlQuery.value(7).toString(), sqlQuery.value(8).toString(), sqlQuery.value(9).toString());
         break;
     case BOOK:
-        result = QSharedPointer<Book>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(10).toString(), sqlQuery.value(11).toString(), sqlQuery.value(12).toString(), sqlQuery.value(13).toString());
+        result = QSharedPointer<Book>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(6).toString(), sqlQuery.value(7).toString(), sqlQuery.value(8).toString(), sqlQuery.value(9).toString());
         break;
     case NORMAL:
-        result = QSharedPointer<NormalItem>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(10).toString(), sqlQuery.value(11).toString(), sqlQuery.value(12).toString(), sqlQuery.value(13).toString());
+        result = QSharedPointer<NormalItem>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(6).toString(), sqlQuery.value(7).toString(), sqlQuery.value(8).toString(), sqlQuery.value(9).toString());
+        break;
+    }
+
+    if (result && !(columns & ITEM_COLUMN_DESCRIPTION))
+        result->setDescriptionLoader([this](int id)
+                                     { return loadItemDescription(id); });
+    return result;
+}
+
+QSharedPointer<Item> Database::archived2Item(const ArchivedItem &item) const
+{
+    Time sendingTime = Time::fromDayKey(item.sendingDay);
+    Time receivingTime = Time::fromDayKey(item.receivingDay);
+
+    QSharedPointer<Item> result;
+    switch (item.type)
+    {
+    case FRAGILE:
+        result = QSharedPointer<FragileItem>::create(item.id, item.cost, item.state, sendingTime, receivingTime, item.srcName, item.dstName, item.expressman, item.description);
+        break;
+    case BOOK:
+        result = QSharedPointer<Book>::create(item.id, item.cost, item.state, sendingTime, receivingTime, item.srcName, item.dstName, item.expressman, item.description);
+        break;
+    case NORMAL:
+        result = QSharedPointer<NormalItem>::create(item.id, item.cost, item.state, sendingTime, receivingTime, item.srcName, item.dstName, item.expressman, item.description);
         break;
     }
 
@@ -374,157 +915,683 @@ QSharedPointer<Item> Database::query2Item(const QSqlQuery &sqlQuery) const
 
 int Database::queryAllUser(QList<QSharedPointer<User>> &result)
 {
+    return queryUserPage(result, "", -1);
+}
 
-    QFile userFile(userFileName);
-    if (!userFile.open(QIODevice::ReadWrite | QIODevice ::Text))
+int Database::queryUserPage(QList<QSharedPointer<User>> &result, const QString &afterUsername, int limit)
+{
+    int cnt = 0;
+    if (config.userStorage == USER_STORAGE_SQLITE)
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        userCommit->flush(); //让user表包含所有已提交的变更
+        QSqlQuery sqlQuery(db);
+        sqlQuery.prepare("SELECT * FROM user WHERE username > :afterUsername ORDER BY username LIMIT :limit");
+        sqlQuery.bindValue(":afterUsername", afterUsername);
+        sqlQuery.bindValue(":limit", limit);
+        exec(sqlQuery);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "数据库:查找用户失败" << sqlQuery.lastError();
+            return 0;
+        }
+        while (sqlQuery.next())
+        {
+            cnt++;
+            result.append(query2User(sqlQuery.value(0).toString(), sqlQuery.value(1).toString(), sqlQuery.value(2).toInt(), sqlQuery.value(3).toInt(), sqlQuery.value(4).toString(), sqlQuery.value(5).toString(), sqlQuery.value(6).toString()));
+        }
+        return cnt;
     }
-    QTextStream stream(&userFile);
-    int type, balance, cnt = 0;
-    QString username, password, name, phoneNumber, address;
-    char ch;
 
-    while (!stream.atEnd())
+    QStringList usernames;
+    for (auto i = userIndex.constBegin(); i != userIndex.constEnd(); i++)
+        if (i.key() > afterUsername)
+            usernames.append(i.key());
+    std::sort(usernames.begin(), usernames.end());
+    for (const QString &username : usernames)
     {
+        if (limit >= 0 && cnt >= limit)
+            break;
         cnt++;
-        stream >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream >> ch;
-        result.append(query2User(username, password, type, balance, name, phoneNumber, address));
+        UserRecord record = userLog.resolve(userIndex[username]);
+        result.append(query2User(username, record.password, record.type, record.balance, record.name, record.phoneNumber, record.address));
     }
-
-    userFile.close();
     return cnt;
 }
 
-int Database::queryItemByFilter(QList<QSharedPointer<Item>> &result, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman) const
+//queryItemByFilter的过滤条件，下标即该条件在语句形状掩码中的位
+static const char *const itemFilterConditions[][2] = {
+    {"id = ", ":id"},
+    {"state = ", ":state"},
+    {"sendingDay >= ", ":sendingFrom"},
+    {"sendingDay <= ", ":sendingTo"},
+    {"receivingDay >= ", ":receivingFrom"},
+    {"receivingDay <= ", ":receivingTo"},
+    {"srcName = ", ":srcName"},
+    {"dstName = ", ":dstName"},
+    {"expressman = ", ":expressman"},
+    {"sendingDay / 100 % 100 = ", ":sendingMonth"},
+    {"sendingDay % 100 = ", ":sendingMonthDay"},
+    {"receivingDay / 100 % 100 = ", ":receivingMonth"},
+    {"receivingDay % 100 = ", ":receivingMonthDay"},
+};
+const int ITEM_FILTER_FIELDS = sizeof(itemFilterConditions) / sizeof(itemFilterConditions[0]);
+
+//把过滤条件展开为各条件的值，未设置的条件为无效的QVariant，返回语句形状掩码
+static int itemFilterValues(const ItemFilter &filter, QVariant (&values)[ITEM_FILTER_FIELDS])
 {
-    QSqlQuery sqlQuery(db);
-    QString queryString("SELECT * FROM item");
-    bool flag = false;
-    if (id != -1)
+    values[0] = filter.id != -1 ? QVariant(filter.id) : QVariant();
+    values[1] = filter.state != -1 ? QVariant(filter.state) : QVariant();
+    values[2] = filter.sendingFrom != -1 ? QVariant(filter.sendingFrom) : QVariant();
+    values[3] = filter.sendingTo != -1 ? QVariant(filter.sendingTo) : QVariant();
+    values[4] = filter.receivingFrom != -1 ? QVariant(filter.receivingFrom) : QVariant();
+    values[5] = filter.receivingTo != -1 ? QVariant(filter.receivingTo) : QVariant();
+    values[6] = !filter.srcName.isEmpty() ? QVariant(filter.srcName) : QVariant();
+    values[7] = !filter.dstName.isEmpty() ? QVariant(filter.dstName) : QVariant();
+    values[8] = !filter.expressman.isEmpty() ? QVariant(filter.expressman) : QVariant();
+    values[9] = filter.sendingMonth != -1 ? QVariant(filter.sendingMonth) : QVariant();
+    values[10] = filter.sendingMonthDay != -1 ? QVariant(filter.sendingMonthDay) : QVariant();
+    values[11] = filter.receivingMonth != -1 ? QVariant(filter.receivingMonth) : QVariant();
+    values[12] = filter.receivingMonthDay != -1 ? QVariant(filter.receivingMonthDay) : QVariant();
+    int mask = 0;
+    for (int i = 0; i < ITEM_FILTER_FIELDS; i++)
+        if (values[i].isValid())
+            mask |= 1 << i;
+    return mask;
+}
+
+//由语句形状掩码生成WHERE子句，没有条件时为空串；hasWhere为true时接在已有的WHERE之后
+static QString itemFilterWhere(int mask, bool hasWhere = false)
+{
+    QString where;
+    for (int i = 0; i < ITEM_FILTER_FIELDS; i++)
+        if (mask & (1 << i))
+        {
+            where += QString(hasWhere ? " AND " : " WHERE ") + itemFilterConditions[i][0] + itemFilterConditions[i][1];
+            hasWhere = true;
+        }
+    return where;
+}
+
+static void bindItemFilter(QSqlQuery &sqlQuery, int mask, const QVariant (&values)[ITEM_FILTER_FIELDS])
+{
+    for (int i = 0; i < ITEM_FILTER_FIELDS; i++)
+        if (mask & (1 << i))
+            sqlQuery.bindValue(itemFilterConditions[i][1], values[i]);
+}
+
+int Database::queryItemByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter) const
+{
+    QString nextCursor;
+    return queryItemByFilter(result, filter, ItemPage(), nextCursor);
+}
+
+int Database::queryItemByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter, const ItemPage &page, QString &nextCursor) const
+{
+    return visitItemsByFilter(filter, page, [&result](const QSharedPointer<Item> &item)
+                              {
+                                  result.append(item);
+                                  return true; },
+                              nextCursor);
+}
+
+//按ITEM_COLUMN_*生成查询的列，列的位置固定，未选择的列用默认值占位，query2Item可以按下标读取
+static QString itemSelectList(const int columns)
+{
+    return QString("id, ") + (columns & ITEM_COLUMN_COST ? "cost" : "0") + ", type, state, " +
+           (columns & ITEM_COLUMN_SENDING_DAY ? "sendingDay" : "-1") + ", " +
+           (columns & ITEM_COLUMN_RECEIVING_DAY ? "receivingDay" : "-1") + ", " +
+           (columns & ITEM_COLUMN_SRC_NAME ? "srcName" : "''") + ", " +
+           (columns & ITEM_COLUMN_DST_NAME ? "dstName" : "''") + ", " +
+           (columns & ITEM_COLUMN_EXPRESSMAN ? "expressman" : "''") + ", " +
+           (columns & ITEM_COLUMN_DESCRIPTION ? "description" : "NULL");
+}
+
+QSqlQuery *Database::execItemFilter(const ItemFilter &filter, const ItemPage &page, int &columns, int &status) const
+{
+    status = 0;
+    int afterDay = 0, afterId = 0;
+    bool hasCursor = !page.cursor.isEmpty();
+    if (hasCursor && !page.decodeCursor(afterDay, afterId))
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "id = :id";
-        flag = true;
+        qWarning() << "数据库：无效的物品游标" << page.cursor;
+        status = -1;
+        return nullptr;
     }
-    if (state != -1)
+    bool byDay = page.orderBy == ITEM_ORDER_SENDING_DAY;
+    //游标需要寄送日期
+    columns = (page.columns & ITEM_COLUMNS_ALL) | (byDay ? ITEM_COLUMN_SENDING_DAY : 0);
+
+    QVariant values[ITEM_FILTER_FIELDS];
+    int mask = itemFilterValues(filter, values);
+
+    //同一形状的语句只编译一次，之后只重新绑定参数。形状由过滤条件、读出的列、排序方式和是否有游标决定
+    QString cacheKey = QString("itemFilter:%1:%2:%3:%4:%5").arg(mask).arg(columns).arg(byDay ? 1 : 0).arg(page.descending ? 1 : 0).arg(hasCursor ? 1 : 0);
+    //查询在调用线程的只读连接上执行，不与写连接争用
+    int selected = columns;
+    QSqlQuery &sqlQuery = pool->readerQuery(cacheKey, [&]()
+                                            {
+                                                QString queryString = "SELECT " + itemSelectList(selected) + " FROM item" + itemFilterWhere(mask);
+                                                //键集分页：从游标之后开始，沿(sendingDay, id)或id上的索引扫描，不使用OFFSET
+                                                if (hasCursor)
+                                                {
+                                                    QString op = page.descending ? " < " : " > ";
+                                                    queryString += QString(mask ? " AND " : " WHERE ") + (byDay ? "(sendingDay, id)" + op + "(:afterDay, :afterId)" : "id" + op + ":afterId");
+                                                }
+                                                QString direction = page.descending ? " DESC" : "";
+                                                queryString += " ORDER BY " + (byDay ? "sendingDay" + direction + ", id" + direction : "id" + direction) + " LIMIT :limit";
+                                                return queryString; });
+    bindItemFilter(sqlQuery, mask, values);
+    if (hasCursor)
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "state = :state";
-        flag = true;
+        if (byDay)
+            sqlQuery.bindValue(":afterDay", afterDay);
+        sqlQuery.bindValue(":afterId", afterId);
     }
-    if (sendingTime.year != -1)
+    sqlQuery.bindValue(":limit", page.limit > 0 ? page.limit : -1);
+
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "sendingTime_Year = :sendingTime_Year";
-        flag = true;
+        qCritical() << "数据库:查找物品失败" << sqlQuery.lastError();
+        return nullptr;
     }
-    if (sendingTime.month != -1)
+    status = 1;
+    return &sqlQuery;
+}
+
+int Database::visitItemsByFilter(const ItemFilter &filter, const ItemPage &page, const ItemVisitor &visitor, QString &nextCursor) const
+{
+    nextCursor.clear();
+    int columns, status;
+    QSqlQuery *sqlQuery = execItemFilter(filter, page, columns, status);
+    if (!sqlQuery)
+        return status;
+
+    int cnt = 0, lastDay = 0, lastId = 0;
+    bool stopped = false;
+    while (sqlQuery->next())
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "sendingTime_Month = :sendingTime_Month";
-        flag = true;
+        lastId = sqlQuery->value(0).toInt();
+        lastDay = sqlQuery->value(4).toInt();
+        cnt++;
+        if (!visitor(query2Item(*sqlQuery, columns))) //将查找结果转换为临时Item对象
+        {
+            stopped = true;
+            break;
+        }
     }
-    if (sendingTime.day != -1)
+    sqlQuery->finish(); //缓存的语句读完或提前停止后立即复位，不再占用读锁
+    if (stopped || (page.limit > 0 && cnt == page.limit))
+        nextCursor = page.encodeCursor(lastDay, lastId);
+    //归档没有键集顺序，只在不分页的查询中接着item表的结果给出
+    else if (filter.includeArchived && page.limit <= 0 && page.cursor.isEmpty())
+        cnt += archive.scan(filter, [&](const ArchivedItem &item)
+                            { return visitor(archived2Item(item)); });
+    qDebug() << "数据库:查找物品成功，共" << cnt << "条";
+    return cnt;
+}
+
+int Database::visitItemRecords(const ItemFilter &filter, const ItemPage &page, ItemBatch &batch, const ItemRecordVisitor &visitor, QString &nextCursor) const
+{
+    nextCursor.clear();
+    int columns, status;
+    QSqlQuery *sqlQuery = execItemFilter(filter, page, columns, status);
+    if (!sqlQuery)
+        return status;
+
+    //批次满了才交给visitor，清空后复用同一块内存
+    int cnt = 0;
+    bool stopped = false;
+    auto flush = [&]()
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "sendingTime_Day = :sendingTime_Day";
-        flag = true;
-    }
-    if (receivingTime.year != -1)
+        for (int i = 0; i < batch.size() && !stopped; i++)
+        {
+            const ItemRecord &record = batch.at(i);
+            cnt++;
+            if (!visitor(batch, record))
+            {
+                stopped = true;
+                nextCursor = page.encodeCursor(record.sendingDay, record.id);
+            }
+        }
+        batch.clear();
+        return !stopped;
+    };
+
+    batch.clear();
+    int rows = 0, lastDay = 0, lastId = 0;
+    while (!stopped && sqlQuery->next())
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "receivingTime_Year = :receivingTime_Year";
-        flag = true;
+        rows++;
+        lastId = sqlQuery->value(0).toInt();
+        lastDay = sqlQuery->value(4).toInt();
+        batch.append(lastId, sqlQuery->value(1).toInt(), sqlQuery->value(2).toInt(), sqlQuery->value(3).toInt(), lastDay, sqlQuery->value(5).toInt(),
+                     sqlQuery->value(6).toString(), sqlQuery->value(7).toString(), sqlQuery->value(8).toString(), sqlQuery->value(9).toString());
+        if (batch.isFull())
+            flush();
     }
-    if (receivingTime.month != -1)
+    sqlQuery->finish();
+    flush();
+    if (!stopped && page.limit > 0 && rows == page.limit)
+        nextCursor = page.encodeCursor(lastDay, lastId);
+    else if (!stopped && filter.includeArchived && page.limit <= 0 && page.cursor.isEmpty())
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "receivingTime_Month = :receivingTime_Month";
-        flag = true;
+        archive.scan(filter, [&](const ArchivedItem &item)
+                     {
+                         batch.append(item.id, item.cost, item.type, item.state, item.sendingDay, item.receivingDay, item.srcName, item.dstName, item.expressman, item.description);
+                         return !batch.isFull() || flush(); });
+        flush();
     }
-    if (receivingTime.day != -1)
+    qDebug() << "数据库:批量查找物品成功，共" << cnt << "条";
+    return cnt;
+}
+
+const int ITEM_ID_BATCH = 256; //按单号批量查询时每条语句的单号个数
+
+QSqlQuery *Database::execItemIds(const QVector<int> &ids, const int begin, const ItemPage &page, int &columns) const
+{
+    //按id游标需要寄送日期
+    columns = (page.columns & ITEM_COLUMNS_ALL) | ITEM_COLUMN_SENDING_DAY;
+    int selected = columns;
+    QSqlQuery &sqlQuery = pool->readerQuery(QString("itemIds:%1:%2").arg(columns).arg(page.descending ? 1 : 0), [&]()
+                                            {
+                                                QString queryString = "SELECT " + itemSelectList(selected) + " FROM item WHERE id IN (";
+                                                for (int i = 0; i < ITEM_ID_BATCH; i++)
+                                                    queryString += (i ? ", :id" : ":id") + QString::number(i);
+                                                return queryString + ") ORDER BY id" + (page.descending ? " DESC" : ""); });
+    //不满一组时用最后一个单号补齐，语句的形状不变
+    int end = qMin(begin + ITEM_ID_BATCH, ids.size());
+    for (int i = 0; i < ITEM_ID_BATCH; i++)
+        sqlQuery.bindValue(":id" + QString::number(i), ids[qMin(begin + i, end - 1)]);
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "receivingTime_Day = :receivingTime_Day";
-        flag = true;
+        qCritical() << "数据库:按单号查找物品失败" << sqlQuery.lastError();
+        return nullptr;
     }
-    if (!srcName.isEmpty())
+    return &sqlQuery;
+}
+
+int Database::visitItemsByIds(const QVector<int> &ids, const ItemPage &page, const ItemVisitor &visitor, QString &nextCursor) const
+{
+    nextCursor.clear();
+    int cnt = 0;
+    for (int begin = 0; begin < ids.size(); begin += ITEM_ID_BATCH)
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "srcName = :srcName";
-        flag = true;
+        int columns;
+        QSqlQuery *sqlQuery = execItemIds(ids, begin, page, columns);
+        if (!sqlQuery)
+            return -1;
+        while (sqlQuery->next())
+        {
+            cnt++;
+            if (!visitor(query2Item(*sqlQuery, columns)))
+            {
+                nextCursor = page.encodeCursor(sqlQuery->value(4).toInt(), sqlQuery->value(0).toInt());
+                sqlQuery->finish();
+                return cnt;
+            }
+        }
+        sqlQuery->finish();
     }
-    if (!dstName.isEmpty())
+    qDebug() << "数据库:按单号查找物品成功，共" << cnt << "条";
+    return cnt;
+}
+
+int Database::visitItemRecordsByIds(const QVector<int> &ids, const ItemPage &page, ItemBatch &batch, const ItemRecordVisitor &visitor, QString &nextCursor) const
+{
+    nextCursor.clear();
+    int cnt = 0;
+    bool stopped = false;
+    auto flush = [&]()
+    {
+        for (int i = 0; i < batch.size() && !stopped; i++)
+        {
+            const ItemRecord &record = batch.at(i);
+            cnt++;
+            if (!visitor(batch, record))
+            {
+                stopped = true;
+                nextCursor = page.encodeCursor(record.sendingDay, record.id);
+            }
+        }
+        batch.clear();
+        return !stopped;
+    };
+
+    batch.clear();
+    for (int begin = 0; begin < ids.size() && !stopped; begin += ITEM_ID_BATCH)
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "dstName = :dstName";
-        flag = true;
+        int columns;
+        QSqlQuery *sqlQuery = execItemIds(ids, begin, page, columns);
+        if (!sqlQuery)
+            return -1;
+        while (!stopped && sqlQuery->next())
+        {
+            batch.append(sqlQuery->value(0).toInt(), sqlQuery->value(1).toInt(), sqlQuery->value(2).toInt(), sqlQuery->value(3).toInt(), sqlQuery->value(4).toInt(), sqlQuery->value(5).toInt(),
+                         sqlQuery->value(6).toString(), sqlQuery->value(7).toString(), sqlQuery->value(8).toString(), sqlQuery->value(9).toString());
+            if (batch.isFull())
+                flush();
+        }
+        sqlQuery->finish();
     }
-    if (!expressman.isEmpty())
+    flush();
+    qDebug() << "数据库:按单号批量查找物品成功，共" << cnt << "条";
+    return cnt;
+}
+
+//aggregateItems的分组列，下标即ITEM_GROUP_*的值
+static const char *const itemGroupColumns[] = {"NULL", "state", "type", "expressman", "sendingDay", "receivingDay"};
+
+bool Database::aggregateItems(const ItemFilter &filter, const int groupBy, QVector<ItemAggregate> &result) const
+{
+    if (groupBy < ITEM_GROUP_NONE || groupBy > ITEM_GROUP_RECEIVING_DAY)
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "expressman = :expressman";
-        flag = true;
+        qWarning() << "数据库：无效的分组方式" << groupBy;
+        return false;
     }
-    sqlQuery.prepare(queryString);
+    QVariant values[ITEM_FILTER_FIELDS];
+    int mask = itemFilterValues(filter, values);
 
-    if (id != -1)
-        sqlQuery.bindValue(":id", id);
-    if (state != -1)
-        sqlQuery.bindValue(":state", state);
-    if (sendingTime.year != -1)
-        sqlQuery.bindValue(":sendingTime_Year", sendingTime.year);
-    if (sendingTime.month != -1)
-        sqlQuery.bindValue(":sendingTime_Month", sendingTime.month);
-    if (sendingTime.day != -1)
-        sqlQuery.bindValue(":sendingTime_Day", sendingTime.day);
-    if (receivingTime.year != -1)
-        sqlQuery.bindValue(":receivingTime_Year", receivingTime.year);
-    if (receivingTime.month != -1)
-        sqlQuery.bindValue(":receivingTime_Month", receivingTime.month);
-    if (receivingTime.day != -1)
-        sqlQuery.bindValue(":receivingTime_Day", receivingTime.day);
-    if (!srcName.isEmpty())
-        sqlQuery.bindValue(":srcName", srcName);
-    if (!dstName.isEmpty())
-        sqlQuery.bindValue(":dstName", dstName);
-    if (!expressman.isEmpty())
-        sqlQuery.bindValue(":expressman", expressman);
+    //只返回每组的数量和费用之和，不读出任何一行物品
+    QSqlQuery &sqlQuery = pool->readerQuery(QString("itemAggregate:%1:%2").arg(mask).arg(groupBy), [&]()
+                                            {
+                                                QString column = itemGroupColumns[groupBy];
+                                                QString queryString = "SELECT " + column + ", COUNT(*), IFNULL(SUM(cost), 0) FROM item" + itemFilterWhere(mask);
+                                                if (groupBy != ITEM_GROUP_NONE)
+                                                    queryString += " GROUP BY " + column + " ORDER BY " + column;
+                                                return queryString; });
+    bindItemFilter(sqlQuery, mask, values);
 
     exec(sqlQuery);
     if (!sqlQuery.exec())
     {
-        qCritical() << "数据库:查找物品失败" << sqlQuery.lastError();
+        qCritical() << "数据库:统计物品失败" << sqlQuery.lastError();
+        return false;
+    }
+    result.clear();
+    while (sqlQuery.next())
+        result.append(ItemAggregate{sqlQuery.value(0), sqlQuery.value(1).toLongLong(), sqlQuery.value(2).toLongLong()});
+    sqlQuery.finish();
+    qDebug() << "数据库:统计物品成功，共" << result.size() << "组";
+    return true;
+}
+
+int Database::searchItems(const QString &text, const ItemFilter &filter, const int limit, QVector<int> &ids) const
+{
+    ids.clear();
+    if (!itemSearchAvailable)
+        return -1;
+    //每个词用双引号括起来按字面匹配，用户输入中的FTS5语法字符不会导致语句出错；分词匹配不了的短词改用LIKE
+    QStringList terms, shortTerms;
+    for (QString term : text.split(' ', Qt::SkipEmptyParts))
+    {
+        if (term.size() < itemSearchMinTerm)
+            shortTerms.append("%" + term.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_") + "%");
+        else
+            terms.append("\"" + term.replace("\"", "\"\"") + "\"");
+    }
+    if (terms.isEmpty() && shortTerms.isEmpty())
         return 0;
+    QVariant values[ITEM_FILTER_FIELDS];
+    int mask = itemFilterValues(filter, values);
+    bool useIndex = !terms.isEmpty();
+
+    //先由全文索引得到候选行，再按rowid取item表的行检查其他条件
+    QSqlQuery &sqlQuery = pool->readerQuery(QString("itemSearch:%1:%2:%3").arg(mask).arg(useIndex ? 1 : 0).arg(shortTerms.size()), [&]()
+                                            {
+                                                QString queryString = useIndex ? "SELECT item.id FROM item_fts JOIN item ON item.id = item_fts.rowid WHERE item_fts MATCH :match"
+                                                                               : "SELECT id FROM item WHERE 1";
+                                                queryString += itemFilterWhere(mask, true);
+                                                for (int i = 0; i < shortTerms.size(); i++)
+                                                    queryString += QString(" AND item.description LIKE :like%1 ESCAPE '\\'").arg(i);
+                                                return queryString + (useIndex ? " ORDER BY bm25(item_fts)" : " ORDER BY id DESC") + " LIMIT :limit"; });
+    if (useIndex)
+        sqlQuery.bindValue(":match", terms.join(' '));
+    for (int i = 0; i < shortTerms.size(); i++)
+        sqlQuery.bindValue(QString(":like%1").arg(i), shortTerms[i]);
+    bindItemFilter(sqlQuery, mask, values);
+    sqlQuery.bindValue(":limit", limit > 0 ? limit : -1);
+
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "数据库:搜索物品失败" << sqlQuery.lastError();
+        return -1;
     }
-    else
+    while (sqlQuery.next())
+        ids.append(sqlQuery.value(0).toInt());
+    sqlQuery.finish();
+    qDebug() << "数据库:搜索物品成功，共" << ids.size() << "条";
+    return ids.size();
+}
+
+int Database::scanItemColumns(ItemColumns &columns) const
+{
+    //rowid按插入的提交顺序递增，从快照中最大的rowid之后读取即可得到所有新插入的行
+    QSqlQuery &sqlQuery = pool->readerQuery("itemColumns", []()
+                                            { return "SELECT rowid, id, cost, type, state, sendingDay, receivingDay, srcName, dstName, expressman FROM item WHERE rowid > :afterRowid ORDER BY rowid"; });
+    sqlQuery.bindValue(":afterRowid", columns.lastRowid());
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
     {
-        int cnt = 0;
-        while (sqlQuery.next())
+        qCritical() << "数据库:读取物品列失败" << sqlQuery.lastError();
+        return -1;
+    }
+    int cnt = 0;
+    while (sqlQuery.next())
+    {
+        columns.append(sqlQuery.value(0).toLongLong(), sqlQuery.value(1).toInt(), sqlQuery.value(2).toInt(), sqlQuery.value(3).toInt(), sqlQuery.value(4).toInt(),
+                       sqlQuery.value(5).toInt(), sqlQuery.value(6).toInt(), sqlQuery.value(7).toString(), sqlQuery.value(8).toString(), sqlQuery.value(9).toString());
+        cnt++;
+    }
+    sqlQuery.finish();
+    return cnt;
+}
+
+int Database::refreshItemColumns(ItemColumns &columns, const QVector<int> &ids) const
+{
+    ItemPage page;
+    page.columns = ITEM_COLUMNS_ALL & ~ITEM_COLUMN_DESCRIPTION;
+    int cnt = 0;
+    for (int begin = 0; begin < ids.size(); begin += ITEM_ID_BATCH)
+    {
+        int selected;
+        QSqlQuery *sqlQuery = execItemIds(ids, begin, page, selected);
+        if (!sqlQuery)
+            return -1;
+        //本组中没有读出的单号已被删除或归档
+        QSet<int> missing;
+        for (int i = begin; i < qMin(begin + ITEM_ID_BATCH, ids.size()); i++)
+            missing.insert(ids[i]);
+        while (sqlQuery->next())
+        {
+            int id = sqlQuery->value(0).toInt();
+            missing.remove(id);
+            cnt += columns.update(id, sqlQuery->value(1).toInt(), sqlQuery->value(2).toInt(), sqlQuery->value(3).toInt(), sqlQuery->value(4).toInt(), sqlQuery->value(5).toInt(),
+                                  sqlQuery->value(6).toString(), sqlQuery->value(7).toString(), sqlQuery->value(8).toString());
+        }
+        sqlQuery->finish();
+        for (int id : missing)
         {
-            result.append(query2Item(sqlQuery)); //将查找结果转换为临时Item对象
+            columns.remove(id);
             cnt++;
         }
-        qDebug() << "数据库:查找物品成功，共" << cnt << "条";
-        return cnt;
     }
+    return cnt;
+}
+
+const int ITEM_CHANGED_LIMIT = 65536; //记录的被修改单号超过该数量时让列式快照整体重建
+
+void Database::markItemChanged(const int id) const
+{
+    QMutexLocker locker(&changedItemsMutex);
+    changedItems.insert(id);
+    if (changedItems.size() > ITEM_CHANGED_LIMIT)
+    {
+        changedItems.clear();
+        itemChanges.fetchAndAddRelease(1);
+    }
+}
+
+QVector<int> Database::takeChangedItemIds() const
+{
+    QMutexLocker locker(&changedItemsMutex);
+    QVector<int> ids;
+    ids.reserve(changedItems.size());
+    for (int id : changedItems)
+        ids.append(id);
+    changedItems.clear();
+    return ids;
+}
+
+qint64 Database::itemChangeSerial() const
+{
+    return itemChanges.loadAcquire();
+}
+
+int Database::archiveItems(const int cutoffDay)
+{
+    const int batchSize = 1000;
+    QSqlQuery &selectQuery = pool->writerQuery("SELECT * FROM item WHERE state = :state AND receivingDay >= 0 AND receivingDay < :cutoff ORDER BY id LIMIT :limit");
+    QSqlQuery &deleteQuery = pool->writerQuery("DELETE FROM item WHERE id = :id");
+    int total = 0;
+    while (true)
+    {
+        selectQuery.bindValue(":state", RECEIVED);
+        selectQuery.bindValue(":cutoff", cutoffDay);
+        selectQuery.bindValue(":limit", batchSize);
+        exec(selectQuery);
+        if (!selectQuery.exec())
+        {
+            qCritical() << "数据库：读取待归档的物品失败" << selectQuery.lastError();
+            return -1;
+        }
+        QVector<ArchivedItem> batch;
+        while (selectQuery.next())
+            batch.append(ArchivedItem{selectQuery.value(0).toInt(), selectQuery.value(1).toInt(), selectQuery.value(2).toInt(), selectQuery.value(3).toInt(), selectQuery.value(4).toInt(), selectQuery.value(5).toInt(),
+                                      selectQuery.value(6).toString(), selectQuery.value(7).toString(), selectQuery.value(8).toString(), selectQuery.value(9).toString()});
+        selectQuery.finish();
+        if (batch.isEmpty())
+            break;
+
+        //归档写入成功后才从item表删除
+        if (!archive.append(batch))
+            return -1;
+        db.transaction();
+        for (const ArchivedItem &item : batch)
+        {
+            deleteQuery.bindValue(":id", item.id);
+            if (!deleteQuery.exec())
+            {
+                qCritical() << "数据库：删除已归档的物品" << item.id << "失败" << deleteQuery.lastError();
+                db.rollback();
+                return -1;
+            }
+        }
+        if (!db.commit())
+        {
+            qCritical() << "数据库：归档提交失败" << db.lastError();
+            db.rollback();
+            return -1;
+        }
+        for (const ArchivedItem &item : batch)
+            markItemChanged(item.id);
+        total += batch.size();
+        qInfo() << "数据库：已归档" << total << "个物品";
+        if (batch.size() < batchSize)
+            break;
+    }
+    return total;
+}
+
+bool Database::queryArchivedItem(const int id, QSharedPointer<Item> &result) const
+{
+    ArchivedItem item;
+    if (!archive.find(id, item))
+        return false;
+    result = archived2Item(item);
+    return true;
+}
+
+QString Database::loadItemDescription(const int id) const
+{
+    QSqlQuery &sqlQuery = pool->readerQuery("itemDescription", []()
+                                            { return QString("SELECT description FROM item WHERE id = :id"); });
+    sqlQuery.bindValue(":id", id);
+    QString description;
+    bool found = false;
+    if (!sqlQuery.exec())
+        qCritical() << "数据库:读取物品描述失败" << sqlQuery.lastError();
+    else if (sqlQuery.next())
+    {
+        description = sqlQuery.value(0).toString();
+        found = true;
+    }
+    sqlQuery.finish();
+    //查询之后被归档的物品从归档中读取
+    ArchivedItem item;
+    if (!found && archive.find(id, item))
+        description = item.description;
+    return description;
 }
 
 bool Database::modifyItemState(const int id, const int state)
 {
-    return modifyData("item", QString::number(id), "state", state);
+    if (!modifyData("item", QString::number(id), "state", state))
+        return false;
+    markItemChanged(id);
+    return true;
 }
 
 bool Database::modifyItemExpressman(const int id, const QString &expressman)
 {
-    return modifyData("item", QString::number(id), "expressman", expressman);
+    if (!modifyData("item", QString::number(id), "expressman", expressman))
+        return false;
+    markItemChanged(id);
+    return true;
 }
 
 bool Database::modifyItemReceivingTime(const int id, const Time &receivingTime)
 {
-    bool flag1 = false, flag2 = false, flag3 = false;
-    flag1 = modifyData("item", QString::number(id), "receivingTime_Year", receivingTime.year);
-    flag2 = modifyData("item", QString::number(id), "receivingTime_Month", receivingTime.month);
-    flag3 = modifyData("item", QString::number(id), "receivingTime_Day", receivingTime.day);
-    return flag1 && flag2 && flag3;
+    if (!modifyData("item", QString::number(id), "receivingDay", receivingTime.toDayKey()))
+        return false;
+    markItemChanged(id);
+    return true;
+}
+
+bool Database::transitionItem(const int id, const int expectedState, const int state, const Time &receivingTime, const QString &expressman)
+{
+    bool setReceivingTime = receivingTime.year != -1, setExpressman = !expressman.isEmpty();
+    //WHERE中的状态检查保证检查与修改之间不会有其他修改插入
+    QSqlQuery &sqlQuery = pool->writerQuery(QString("UPDATE item SET state = :state") + (setReceivingTime ? ", receivingDay = :receivingDay" : "") + (setExpressman ? ", expressman = :expressman" : "") + " WHERE id = :id AND state = :expectedState");
+    sqlQuery.bindValue(":state", state);
+    if (setReceivingTime)
+        sqlQuery.bindValue(":receivingDay", receivingTime.toDayKey());
+    if (setExpressman)
+        sqlQuery.bindValue(":expressman", expressman);
+    sqlQuery.bindValue(":id", id);
+    sqlQuery.bindValue(":expectedState", expectedState);
+
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "数据库:物品" << id << "状态转换失败" << sqlQuery.lastError();
+        return false;
+    }
+    if (sqlQuery.numRowsAffected() != 1)
+    {
+        qDebug() << "数据库:物品" << id << "不处于状态" << expectedState << "，未转换";
+        return false;
+    }
+    markItemChanged(id);
+    qDebug() << "数据库:物品" << id << "状态由" << expectedState << "转换为" << state;
+    return true;
 }
 
 bool Database::deleteItem(const int id) const
 {
-    QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("DELETE FROM item WHERE id = :id");
+    QSqlQuery &sqlQuery = pool->writerQuery("DELETE FROM item WHERE id = :id");
     sqlQuery.bindValue(":id", id);
     exec(sqlQuery);
     if (!sqlQuery.exec())
@@ -534,45 +1601,16 @@ bool Database::deleteItem(const int id) const
     }
     else
     {
+        markItemChanged(id);
         qDebug() << "数据库删除id为 " << id << " 的项成功";
         return true;
     }
 }
 
-bool Database::deleteUser(const QString targetUsername) const
+bool Database::deleteUser(const QString targetUsername)
 {
     if (!usernameSet.contains(targetUsername))
         return false;
 
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
-    QFile userFile1(userFileName), userFile2("../data/tempUsers.txt");
-    if (!userFile1.open(QIODevice::ReadWrite | QIODevice ::Text))
-    {
-        qCritical() << "user文件打开失败";
-        exit(1);
-    }
-    if (!userFile2.open(QIODevice::ReadWrite | QIODevice ::Text))
-    {
-        qCritical() << "user文件打开失败";
-        exit(1);
-    }
-    QTextStream stream1(&userFile1);
-    QTextStream stream2(&userFile2);
-
-    while (!stream1.atEnd())
-    {
-        stream1 >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream1 >> ch; //吃一个回车
-        qDebug() << username << password << type << balance << name << phoneNumber << address;
-        if (username != targetUsername)
-            stream2 << username << " " << password << " " << type << " " << balance << " " << name << " " << phoneNumber << " " << address << Qt::endl;
-    }
-    userFile1.close();
-    userFile2.close();
-    QDir dir;
-    dir.remove(userFileName);
-    dir.rename("../data/tempUsers.txt", userFileName);
-    return true;
-}
+    return commitUsers({UserChange{targetUsername, true, UserRecord()}});
+}
\ No newline at end of file
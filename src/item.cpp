@@ -11,15 +11,49 @@
 
 #include "../include/item.h"
 #include "../include/database.h"
+#include "../include/itembatch.h"
+#include "../include/itemcolumns.h"
+#include <algorithm>
 
 void Item::insertInfo2DB(Database *db)
 {
-    db->insertItem(id, cost, type, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
+    db->insertItem(id, cost, type, state, sendingTime, receivingTime, symbolName(srcName), symbolName(dstName), symbolName(expressman), description);
 }
 
-ItemManage::ItemManage(Database *_db) : db(_db)
+QString ItemPage::encodeCursor(int day, int id) const
 {
-    total = db->getDBMaxId("item");
+    QString plain = QString("%1:%2:%3:%4").arg(orderBy).arg(descending ? 1 : 0).arg(day).arg(id);
+    return QString::fromLatin1(plain.toLatin1().toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals));
+}
+
+bool ItemPage::decodeCursor(int &day, int &id) const
+{
+    QStringList fields = QString::fromLatin1(QByteArray::fromBase64(cursor.toLatin1(), QByteArray::Base64UrlEncoding)).split(':');
+    if (fields.size() != 4 || fields[0].toInt() != orderBy || fields[1].toInt() != (descending ? 1 : 0))
+        return false;
+    bool ok1, ok2;
+    day = fields[2].toInt(&ok1);
+    id = fields[3].toInt(&ok2);
+    return ok1 && ok2;
+}
+
+ItemManage::ItemManage(Database *_db, int cacheCapacity, bool _columnar) : db(_db), itemCache(qMax(1, cacheCapacity)), cacheCounters{0, 0, 0, qMax(1, cacheCapacity)}, cacheGeneration(0), batchCounters{0, 0, 0, 0}, columnar(_columnar), columns(nullptr), columnsSerial(-1)
+{
+}
+
+ItemManage::~ItemManage()
+{
+    ItemCacheStats stats = cacheStats();
+    qInfo() << "物品：缓存命中" << stats.hits << "次，未命中" << stats.misses << "次";
+    ItemBatchStats batches = batchStats();
+    if (batches.rows > 0)
+    {
+        double bytesPerRow = double(batches.bytes) / batches.rows, allocationsPerRow = double(batches.allocations) / batches.rows;
+        qInfo() << "物品：批量查询" << batches.rows << "行，每行" << bytesPerRow << "字节(目标" << ITEM_TARGET_BYTES_PER_ROW << ")，每行分配" << allocationsPerRow << "次(目标" << ITEM_TARGET_ALLOCATIONS_PER_ROW << ")";
+        if (bytesPerRow > ITEM_TARGET_BYTES_PER_ROW || allocationsPerRow > ITEM_TARGET_ALLOCATIONS_PER_ROW)
+            qWarning() << "物品：批量查询的内存占用超出目标";
+    }
+    delete columns;
 }
 
 int ItemManage::insertItem(
@@ -34,64 +68,271 @@ int ItemManage::insertItem(
     const QString &description)
 {
     qDebug() << "添加物品 ";
+    int id = db->allocateItemIds(1);
+    if (id == -1)
+        return -1;
     QSharedPointer<Item> item;
     switch (type)
     {
     case FRAGILE:
-        item = QSharedPointer<FragileItem>::create(++total, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
+        item = QSharedPointer<FragileItem>::create(id, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
         break;
     case BOOK:
-        item = QSharedPointer<Book>::create(++total, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
+        item = QSharedPointer<Book>::create(id, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
         break;
     case NORMAL:
-        item = QSharedPointer<NormalItem>::create(++total, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
+        item = QSharedPointer<NormalItem>::create(id, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
         break;
     }
     item->insertInfo2DB(db);
-    return total;
+    return id;
+}
+
+int ItemManage::insertItems(const QVector<ItemSpec> &specs)
+{
+    qDebug() << "批量添加物品" << specs.size() << "个";
+    for (const ItemSpec &spec : specs)
+        if (spec.type != FRAGILE && spec.type != BOOK && spec.type != NORMAL)
+        {
+            qWarning() << "批量添加物品失败：物品类型有误" << spec.type;
+            return -1;
+        }
+    if (specs.isEmpty())
+        return 0;
+
+    //一次分配整段id
+    int firstId = db->allocateItemIds(specs.size());
+    if (firstId == -1 || !db->insertItems(firstId, specs))
+        return -1;
+    return firstId;
 }
 
 int ItemManage::queryAll(QList<QSharedPointer<Item>> &result) const
 {
     qDebug() << "查询所有物品";
-    return db->queryItemByFilter(result, -1, -1, Time(-1, -1, -1), Time(-1, -1, -1), "", "", "");
+    return db->queryItemByFilter(result, ItemFilter());
 }
 
-int ItemManage::queryByFilter(QList<QSharedPointer<Item>> &result, const int id, const int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman) const
+int ItemManage::queryByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter) const
 {
     qDebug() << "按条件查询";
-    return db->queryItemByFilter(result, id, state, sendingTime, receivingTime, srcName, dstName, expressman);
+    return db->queryItemByFilter(result, filter);
 }
 
-bool ItemManage::queryById(QSharedPointer<Item> &result, const int id) const
+int ItemManage::queryByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter, const int columns) const
 {
+    qDebug() << "按条件查询部分列";
+    ItemPage page;
+    page.columns = columns;
+    QString nextCursor;
+    return db->queryItemByFilter(result, filter, page, nextCursor);
+}
+
+int ItemManage::queryByFilter(QList<QSharedPointer<Item>> &result, const ItemFilter &filter, const ItemPage &page, QString &nextCursor) const
+{
+    qDebug() << "按条件分页查询";
+    return db->queryItemByFilter(result, filter, page, nextCursor);
+}
+
+//查询条件的个数
+static int countConditions(const ItemFilter &filter)
+{
+    return (filter.id != -1) + (filter.state != -1) + (filter.sendingFrom != -1 || filter.sendingTo != -1) + (filter.receivingFrom != -1 || filter.receivingTo != -1) +
+           !filter.srcName.isEmpty() + !filter.dstName.isEmpty() + !filter.expressman.isEmpty() +
+           (filter.sendingMonth != -1 || filter.sendingMonthDay != -1) + (filter.receivingMonth != -1 || filter.receivingMonthDay != -1);
+}
+
+int ItemManage::visitByFilter(const ItemFilter &filter, const ItemPage &page, const ItemVisitor &visitor, QString &nextCursor) const
+{
+    qDebug() << "按条件逐条查询";
+    QVector<int> ids;
+    bool unpaged = page.limit <= 0 && page.cursor.isEmpty() && page.orderBy == ITEM_ORDER_ID && !filter.includeArchived;
+    if (!unpaged || countConditions(filter) < 2 || filterColumns(filter, ids) < 0)
+        return db->visitItemsByFilter(filter, page, visitor, nextCursor);
+
+    //只有匹配的行按id分组从数据库读出
+    if (page.descending)
+        std::reverse(ids.begin(), ids.end());
+    return db->visitItemsByIds(ids, page, visitor, nextCursor);
+}
+
+int ItemManage::visitRecords(const ItemFilter &filter, const ItemPage &page, const ItemRecordVisitor &visitor, QString &nextCursor) const
+{
+    qDebug() << "按条件批量查询";
+    ItemBatch batch;
+    QVector<int> ids;
+    bool unpaged = page.limit <= 0 && page.cursor.isEmpty() && page.orderBy == ITEM_ORDER_ID && !filter.includeArchived;
+    int cnt = 0;
+    if (!unpaged || countConditions(filter) < 2 || filterColumns(filter, ids) < 0)
+        cnt = db->visitItemRecords(filter, page, batch, visitor, nextCursor);
+    else
+    {
+        //与visitByFilter相同，只有匹配的行按id分组读出
+        if (page.descending)
+            std::reverse(ids.begin(), ids.end());
+        cnt = db->visitItemRecordsByIds(ids, page, batch, visitor, nextCursor);
+    }
+
+    ItemBatchStats stats = batch.stats();
+    QMutexLocker locker(&batchMutex);
+    batchCounters.batches += stats.batches;
+    batchCounters.rows += stats.rows;
+    batchCounters.bytes += stats.bytes;
+    batchCounters.allocations += stats.allocations;
+    return cnt;
+}
+
+int ItemManage::filterColumns(const ItemFilter &filter, QVector<int> &ids) const
+{
+    //只给出月或日的条件不是日期键上的区间，交给数据库
+    if (!columnar || filter.sendingMonth != -1 || filter.sendingMonthDay != -1 || filter.receivingMonth != -1 || filter.receivingMonthDay != -1)
+        return -1;
+    QMutexLocker locker(&columnsMutex);
+    if (!columns)
+        columns = new ItemColumns;
+    //先读失效次数再取被修改的单号，两者之间的失效在下次查询时重建
+    qint64 serial = db->itemChangeSerial();
+    QVector<int> changed = db->takeChangedItemIds();
+    //被修改或删除的行原位更新，已删除的行过多或记录的单号不完整时整体重建
+    if (serial != columnsSerial || columns->removedCount() > columns->size() / 2)
+    {
+        columns->clear();
+        columnsSerial = serial;
+    }
+    else if (!changed.isEmpty())
+    {
+        int refreshed = db->refreshItemColumns(*columns, changed);
+        if (refreshed < 0)
+        {
+            //已取出的单号无法再更新，下次查询时整体重建
+            columnsSerial = -1;
+            return -1;
+        }
+        qDebug() << "物品：列式快照更新" << refreshed << "行";
+    }
+    int appended = db->scanItemColumns(*columns);
+    if (appended < 0)
+        return -1;
+    if (appended > 0)
+        qDebug() << "物品：列式快照追加" << appended << "行，共" << columns->size() << "行，" << columns->memoryBytes() / 1024 << "KiB";
+    ids = columns->filter(filter);
+    return ids.size();
+}
+
+bool ItemManage::aggregate(const ItemFilter &filter, const int groupBy, QVector<ItemAggregate> &result) const
+{
+    qDebug() << "按条件统计";
+    return db->aggregateItems(filter, groupBy, result);
+}
+
+int ItemManage::search(const QString &text, const ItemFilter &filter, const int limit, QVector<int> &ids) const
+{
+    qDebug() << "按描述搜索" << text;
+    return db->searchItems(text, filter, limit, ids);
+}
+
+bool ItemManage::queryById(QSharedPointer<Item> &result, const int id, const bool includeArchived) const
+{
+    qint64 generation;
+    {
+        QMutexLocker locker(&cacheMutex);
+        QSharedPointer<Item> *cached = itemCache.object(id);
+        if (cached)
+        {
+            cacheCounters.hits++;
+            result = *cached;
+            return true;
+        }
+        cacheCounters.misses++;
+        generation = cacheGeneration;
+    }
+
+    //按id查询多用于检查状态和用户，描述信息留到第一次访问时再读
     QList<QSharedPointer<Item>> temp;
-    if (db->queryItemByFilter(temp, id, -1, Time(-1, -1, -1), Time(-1, -1, -1), "", "", ""))
+    ItemFilter filter;
+    filter.id = id;
+    ItemPage page;
+    page.columns = ITEM_COLUMNS_ALL & ~ITEM_COLUMN_DESCRIPTION;
+    QString nextCursor;
+    if (!db->queryItemByFilter(temp, filter, page, nextCursor))
+        //缓存只保存item表中的物品，归档中查到的不放入缓存，否则不查归档的调用也会命中
+        return includeArchived && db->queryArchivedItem(id, result);
+    result = temp[0];
+    //读数据库期间有物品被修改时不放入缓存：读到的可能是修改前的行，而对应的失效已经发生
+    QMutexLocker locker(&cacheMutex);
+    if (generation == cacheGeneration)
+        itemCache.insert(id, new QSharedPointer<Item>(result));
+    return true;
+}
+
+int ItemManage::archive(const int cutoffDay)
+{
+    qDebug() << "归档接收日期早于" << cutoffDay << "的物品";
+    int cnt = db->archiveItems(cutoffDay);
+    //被归档的物品已不在item表中，缓存整体清空
+    if (cnt > 0)
     {
-        result = temp[0];
-        return true;
+        QMutexLocker locker(&cacheMutex);
+        itemCache.clear();
+        cacheGeneration++;
     }
-    else
-        return false;
+    return cnt;
+}
+
+void ItemManage::invalidate(const int id) const
+{
+    QMutexLocker locker(&cacheMutex);
+    itemCache.remove(id);
+    cacheGeneration++;
+}
+
+ItemBatchStats ItemManage::batchStats() const
+{
+    QMutexLocker locker(&batchMutex);
+    return batchCounters;
+}
+
+ItemCacheStats ItemManage::cacheStats() const
+{
+    QMutexLocker locker(&cacheMutex);
+    ItemCacheStats stats = cacheCounters;
+    stats.size = itemCache.size();
+    return stats;
+}
+
+bool ItemManage::transition(const int id, const int expectedState, const int state, const Time &receivingTime, const QString &expressman)
+{
+    //写入之后再使缓存失效，避免并发的查询把旧值重新放进缓存
+    bool ok = db->transitionItem(id, expectedState, state, receivingTime, expressman);
+    invalidate(id);
+    return ok;
 }
 
 bool ItemManage::modifyState(const int id, const int state)
 {
-    return db->modifyItemState(id, state);
+    bool ok = db->modifyItemState(id, state);
+    invalidate(id);
+    return ok;
 }
 
 bool ItemManage::modifyReceivingTime(const int id, const Time &receivingTime)
 {
-    return db->modifyItemReceivingTime(id, receivingTime);
+    bool ok = db->modifyItemReceivingTime(id, receivingTime);
+    invalidate(id);
+    return ok;
 }
 
 bool ItemManage::modifyExpressman(const int id, const QString &expressman)
 {
-    return db->modifyItemExpressman(id, expressman);
+    bool ok = db->modifyItemExpressman(id, expressman);
+    invalidate(id);
+    return ok;
 }
 
 bool ItemManage::deleteItem(const int id) const
 {
     qDebug() << "删除id为" << id << "的物品";
-    return db->deleteItem(id);
+    bool ok = db->deleteItem(id);
+    invalidate(id);
+    return ok;
 }
\ No newline at end of file
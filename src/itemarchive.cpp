@@ -0,0 +1,327 @@
+﻿/**
+ * @file itemarchive.cpp
+ * @author Haolin Yang
+ * @brief 已签收物品冷归档的实现
+ * @version 0.1
+ * @date 2022-05-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/itemarchive.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QMap>
+#include <algorithm>
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const quint32 ARCHIVE_BLOCK_MAGIC = 0x49415243; //块的标识
+const int ARCHIVE_BLOCK_HEADER_SIZE = 14;        //块头: 标识、物品数量、压缩后长度、校验和
+const int ARCHIVE_INDEX_RECORD_SIZE = 16;        //索引记录: id、月份、偏移
+const char *const ARCHIVE_INDEX_FILE = "index.bin";
+
+ItemArchive::ItemArchive(const QString &_dirName) : dirName(_dirName)
+{
+}
+
+//把已flush的文件内容同步到磁盘，QFile::flush只写入操作系统缓存
+static bool syncFile(QFile &file)
+{
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return ::fsync(file.handle()) == 0;
+#endif
+}
+
+//同步目录项，新建的文件在掉电后仍能找到
+static bool syncDir(const QString &dirName)
+{
+#ifdef Q_OS_WIN
+    Q_UNUSED(dirName);
+    return true;
+#else
+    int fd = ::open(QFile::encodeName(dirName).constData(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+QString ItemArchive::segmentFileName(int month) const
+{
+    return dirName + "/" + QString::number(month) + ".seg";
+}
+
+int ItemArchive::load()
+{
+    QMutexLocker locker(&mutex);
+    index.clear();
+    QFile file(dirName + "/" + ARCHIVE_INDEX_FILE);
+    if (!file.exists())
+        return 0;
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "归档：索引打开失败" << file.errorString();
+        return 0;
+    }
+    QByteArray bytes = file.readAll();
+    file.close();
+
+    QDataStream stream(bytes);
+    int records = bytes.size() / ARCHIVE_INDEX_RECORD_SIZE;
+    //写到一半的尾部记录截掉，否则之后追加的记录都会错位
+    qint64 validSize = qint64(records) * ARCHIVE_INDEX_RECORD_SIZE;
+    if (validSize != bytes.size())
+    {
+        qWarning() << "归档：截掉索引尾部不完整的" << bytes.size() - validSize << "字节";
+        if (!file.resize(validSize))
+            qCritical() << "归档：索引截断失败" << file.errorString();
+    }
+    index.reserve(records);
+    for (int i = 0; i < records; i++)
+    {
+        qint32 id, month;
+        qint64 offset;
+        stream >> id >> month >> offset;
+        index.insert(id, Location{month, offset});
+    }
+    qInfo() << "归档：载入" << index.size() << "个物品的索引";
+    return index.size();
+}
+
+bool ItemArchive::append(const QVector<ArchivedItem> &items)
+{
+    QMutexLocker locker(&mutex);
+    //按接收月份分段，每段写一个块
+    QMap<int, QVector<const ArchivedItem *>> months;
+    for (const ArchivedItem &item : items)
+        if (!index.contains(item.id))
+            months[item.receivingDay / 100].append(&item);
+    if (months.isEmpty())
+        return true;
+    if (!QDir().mkpath(dirName))
+    {
+        qCritical() << "归档：无法创建目录" << dirName;
+        return false;
+    }
+
+    QByteArray indexBytes;
+    QDataStream indexStream(&indexBytes, QIODevice::WriteOnly);
+    QHash<int, Location> added;
+    bool created = false;
+    for (auto i = months.constBegin(); i != months.constEnd(); i++)
+    {
+        QByteArray payload;
+        {
+            QDataStream stream(&payload, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_5_15);
+            for (const ArchivedItem *item : i.value())
+                stream << qint32(item->id) << qint32(item->cost) << qint32(item->type) << qint32(item->state) << qint32(item->sendingDay) << qint32(item->receivingDay)
+                       << item->srcName << item->dstName << item->expressman << item->description;
+        }
+        QByteArray compressed = qCompress(payload);
+
+        QFile segment(segmentFileName(i.key()));
+        created |= !segment.exists();
+        if (!segment.open(QIODevice::WriteOnly | QIODevice::Append))
+        {
+            qCritical() << "归档：段文件打开失败" << segment.fileName() << segment.errorString();
+            return false;
+        }
+        qint64 offset = segment.size();
+        QDataStream header(&segment);
+        header << ARCHIVE_BLOCK_MAGIC << quint32(i.value().size()) << quint32(compressed.size()) << qChecksum(compressed.constData(), compressed.size());
+        //调用者在返回后删除源数据，块必须先落盘
+        if (segment.write(compressed) != compressed.size() || !segment.flush() || !syncFile(segment))
+        {
+            qCritical() << "归档：段文件写入失败" << segment.fileName() << segment.errorString();
+            return false;
+        }
+        segment.close();
+
+        for (const ArchivedItem *item : i.value())
+        {
+            indexStream << qint32(item->id) << qint32(i.key()) << offset;
+            added.insert(item->id, Location{i.key(), offset});
+        }
+    }
+
+    //所有块写完后才写索引，中断时新块不在索引中，等同于没有写入
+    QFile indexFile(dirName + "/" + ARCHIVE_INDEX_FILE);
+    created |= !indexFile.exists();
+    if (!indexFile.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        qCritical() << "归档：索引打开失败" << indexFile.errorString();
+        return false;
+    }
+    qint64 indexSize = indexFile.size();
+    if (indexFile.write(indexBytes) != indexBytes.size() || !indexFile.flush() || !syncFile(indexFile))
+    {
+        //撤销写了一部分的记录，保持索引按记录对齐
+        qCritical() << "归档：索引写入失败" << indexFile.errorString();
+        indexFile.resize(indexSize);
+        return false;
+    }
+    indexFile.close();
+    if (created && !syncDir(dirName))
+    {
+        qCritical() << "归档：目录同步失败" << dirName;
+        return false;
+    }
+    for (auto i = added.constBegin(); i != added.constEnd(); i++)
+        index.insert(i.key(), i.value());
+    qDebug() << "归档：写入" << added.size() << "个物品，共" << months.size() << "段";
+    return true;
+}
+
+bool ItemArchive::readBlock(int month, qint64 offset, QVector<ArchivedItem> &items, qint64 *next) const
+{
+    QFile segment(segmentFileName(month));
+    if (!segment.open(QIODevice::ReadOnly) || !segment.seek(offset))
+        return false;
+    QDataStream header(&segment);
+    quint32 magic, count, length;
+    quint16 checksum;
+    header >> magic >> count >> length >> checksum;
+    if (header.status() != QDataStream::Ok || magic != ARCHIVE_BLOCK_MAGIC)
+        return false;
+    QByteArray compressed = segment.read(length);
+    if (compressed.size() != int(length) || qChecksum(compressed.constData(), compressed.size()) != checksum)
+    {
+        qWarning() << "归档：" << segment.fileName() << "偏移" << offset << "处的块已损坏";
+        return false;
+    }
+    if (next)
+        *next = offset + ARCHIVE_BLOCK_HEADER_SIZE + length;
+
+    QDataStream stream(qUncompress(compressed));
+    stream.setVersion(QDataStream::Qt_5_15);
+    items.resize(count);
+    for (ArchivedItem &item : items)
+    {
+        qint32 id, cost, type, state, sendingDay, receivingDay;
+        stream >> id >> cost >> type >> state >> sendingDay >> receivingDay >> item.srcName >> item.dstName >> item.expressman >> item.description;
+        item.id = id;
+        item.cost = cost;
+        item.type = type;
+        item.state = state;
+        item.sendingDay = sendingDay;
+        item.receivingDay = receivingDay;
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool ItemArchive::find(int id, ArchivedItem &result) const
+{
+    Location location;
+    {
+        QMutexLocker locker(&mutex);
+        auto iter = index.constFind(id);
+        if (iter == index.constEnd())
+            return false;
+        location = iter.value();
+    }
+    QVector<ArchivedItem> items;
+    if (!readBlock(location.month, location.offset, items))
+        return false;
+    for (const ArchivedItem &item : items)
+        if (item.id == id)
+        {
+            result = item;
+            return true;
+        }
+    return false;
+}
+
+bool ItemArchive::matches(const ItemFilter &filter, const ArchivedItem &item)
+{
+    return (filter.id == -1 || item.id == filter.id) &&
+           (filter.state == -1 || item.state == filter.state) &&
+           (filter.sendingFrom == -1 || item.sendingDay >= filter.sendingFrom) &&
+           (filter.sendingTo == -1 || item.sendingDay <= filter.sendingTo) &&
+           (filter.receivingFrom == -1 || item.receivingDay >= filter.receivingFrom) &&
+           (filter.receivingTo == -1 || item.receivingDay <= filter.receivingTo) &&
+           (filter.srcName.isEmpty() || item.srcName == filter.srcName) &&
+           (filter.dstName.isEmpty() || item.dstName == filter.dstName) &&
+           (filter.expressman.isEmpty() || item.expressman == filter.expressman) &&
+           (filter.sendingMonth == -1 || item.sendingDay / 100 % 100 == filter.sendingMonth) &&
+           (filter.sendingMonthDay == -1 || item.sendingDay % 100 == filter.sendingMonthDay) &&
+           (filter.receivingMonth == -1 || item.receivingDay / 100 % 100 == filter.receivingMonth) &&
+           (filter.receivingMonthDay == -1 || item.receivingDay % 100 == filter.receivingMonthDay);
+}
+
+int ItemArchive::scan(const ItemFilter &filter, const std::function<bool(const ArchivedItem &)> &visitor) const
+{
+    //按id查询时只读一个块
+    if (filter.id != -1)
+    {
+        ArchivedItem item;
+        if (find(filter.id, item) && matches(filter, item))
+        {
+            visitor(item);
+            return 1;
+        }
+        return 0;
+    }
+
+    QHash<int, Location> snapshot;
+    {
+        QMutexLocker locker(&mutex);
+        snapshot = index;
+    }
+    QVector<int> months;
+    for (const QString &fileName : QDir(dirName).entryList({"*.seg"}, QDir::Files))
+    {
+        int month = fileName.left(fileName.size() - 4).toInt();
+        //接收日期的范围之外的段整段跳过
+        if ((filter.receivingFrom != -1 && month < filter.receivingFrom / 100) || (filter.receivingTo != -1 && month > filter.receivingTo / 100))
+            continue;
+        months.append(month);
+    }
+    std::sort(months.begin(), months.end());
+
+    int cnt = 0;
+    for (int month : months)
+    {
+        qint64 offset = 0, next = 0;
+        QVector<ArchivedItem> items;
+        while (readBlock(month, offset, items, &next))
+        {
+            for (const ArchivedItem &item : items)
+            {
+                //不在索引中或索引指向别处的是中断后留下的副本
+                auto iter = snapshot.constFind(item.id);
+                if (iter == snapshot.constEnd() || iter.value().month != month || iter.value().offset != offset || !matches(filter, item))
+                    continue;
+                cnt++;
+                if (!visitor(item))
+                    return cnt;
+            }
+            offset = next;
+        }
+    }
+    return cnt;
+}
+
+bool ItemArchive::contains(int id) const
+{
+    QMutexLocker locker(&mutex);
+    return index.contains(id);
+}
+
+int ItemArchive::size() const
+{
+    QMutexLocker locker(&mutex);
+    return index.size();
+}
@@ -0,0 +1,75 @@
+﻿/**
+ * @file itembatch.cpp
+ * @author Haolin Yang
+ * @brief 扁平的物品记录和批量查询结果的实现
+ * @version 0.1
+ * @date 2022-05-21
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/itembatch.h"
+#include <cstring>
+
+//构造时的两次预留计入分配次数
+ItemBatch::ItemBatch() : counters{0, 0, 0, 2}
+{
+    records.reserve(ITEM_BATCH_ROWS);
+    texts.reserve(ITEM_BATCH_ROWS * ITEM_BATCH_TEXT_PER_ROW);
+}
+
+ItemText ItemBatch::addText(const QString &value)
+{
+    ItemText text{texts.size(), value.size()};
+    if (texts.size() + value.size() > texts.capacity())
+    {
+        //字符区不够时翻倍，已有的记录只保存偏移，不受搬移影响
+        texts.reserve(qMax(texts.capacity() * 2, texts.size() + value.size()));
+        counters.allocations++;
+    }
+    texts.resize(texts.size() + value.size());
+    if (value.size() > 0)
+        memcpy(texts.data() + text.offset, value.constData(), value.size() * sizeof(QChar));
+    return text;
+}
+
+ItemRecord &ItemBatch::append(int id, int cost, int type, int state, int sendingDay, int receivingDay,
+                              const QString &srcName, const QString &dstName, const QString &expressman, const QString &description)
+{
+    if (records.size() == records.capacity())
+    {
+        records.reserve(records.capacity() * 2 + 1);
+        counters.allocations++;
+    }
+    ItemRecord record;
+    record.id = id;
+    record.cost = cost;
+    record.type = qint16(type);
+    record.state = qint16(state);
+    record.sendingDay = sendingDay;
+    record.receivingDay = receivingDay;
+    record.srcName = internSymbol(srcName);
+    record.dstName = internSymbol(dstName);
+    record.expressman = internSymbol(expressman);
+    record.description = addText(description);
+    records.append(record);
+    return records.last();
+}
+
+void ItemBatch::clear()
+{
+    counters = stats();
+    //resize(0)保留容量，下一批不再分配
+    records.resize(0);
+    texts.resize(0);
+}
+
+ItemBatchStats ItemBatch::stats() const
+{
+    ItemBatchStats result = counters;
+    result.batches += records.isEmpty() ? 0 : 1;
+    result.rows += records.size();
+    result.bytes += qint64(records.size()) * sizeof(ItemRecord) + qint64(texts.size()) * sizeof(QChar);
+    return result;
+}
@@ -0,0 +1,200 @@
+﻿/**
+ * @file itemcolumns.cpp
+ * @author Haolin Yang
+ * @brief 物品表列式内存快照的实现
+ * @version 0.1
+ * @date 2022-05-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/itemcolumns.h"
+#include <QSemaphore>
+#include <algorithm>
+#include <climits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const int ITEM_COLUMNS_CHUNK = 65536; //每个线程池任务处理的行数
+const qint32 ITEM_COLUMNS_REMOVED = -1; //已删除的行的物品单号
+
+/**
+ * @brief 一列上的闭区间条件
+ */
+struct ColumnRange
+{
+    const qint32 *column; //列
+    qint32 low;           //下界
+    qint32 high;          //上界
+};
+
+//selected[i]在column[i]不在[low, high]中时清零。把column[i] - low当作无符号数与high - low比较，一次比较即可判断两端
+static void rangeKernel(const qint32 *column, int count, qint32 low, qint32 high, quint8 *selected)
+{
+    int i = 0;
+    const quint32 width = quint32(high) - quint32(low);
+#ifdef __SSE2__
+    //SSE2没有无符号比较，两边同时翻转符号位后用有符号比较代替
+    const __m128i lowVector = _mm_set1_epi32(low);
+    const __m128i bias = _mm_set1_epi32(INT_MIN);
+    const __m128i bound = _mm_set1_epi32(qint32(width ^ 0x80000000u));
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i outside[4];
+        for (int k = 0; k < 4; k++)
+        {
+            __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(column + i + 4 * k));
+            value = _mm_xor_si128(_mm_sub_epi32(value, lowVector), bias);
+            outside[k] = _mm_cmpgt_epi32(value, bound);
+        }
+        //16个32位的比较结果饱和压缩为16个字节，区间外的行为0xFF
+        __m128i mask = _mm_packs_epi16(_mm_packs_epi32(outside[0], outside[1]), _mm_packs_epi32(outside[2], outside[3]));
+        __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i *>(selected + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(selected + i), _mm_andnot_si128(mask, current));
+    }
+#endif
+    for (; i < count; i++)
+        selected[i] &= quint32(column[i]) - quint32(low) <= width;
+}
+
+ItemColumns::ItemColumns() : maxRowid(0), removedRows(0)
+{
+}
+
+void ItemColumns::clear()
+{
+    for (QVector<qint32> *column : {&ids, &costs, &types, &states, &sendingDays, &receivingDays, &srcNames, &dstNames, &expressmen})
+        column->clear();
+    rowids.clear();
+    maxRowid = 0;
+    rowOfId.clear();
+    removedRows = 0;
+}
+
+void ItemColumns::append(qint64 rowid, int id, int cost, int type, int state, int sendingDay, int receivingDay, const QString &srcName, const QString &dstName, const QString &expressman)
+{
+    //扫描起点回退后可能再次读到已有的行
+    if (update(id, cost, type, state, sendingDay, receivingDay, srcName, dstName, expressman))
+    {
+        maxRowid = qMax(maxRowid, rowid);
+        return;
+    }
+    rowOfId.insert(id, ids.size());
+    rowids.append(rowid);
+    ids.append(id);
+    costs.append(cost);
+    types.append(type);
+    states.append(state);
+    sendingDays.append(sendingDay);
+    receivingDays.append(receivingDay);
+    srcNames.append(internSymbol(srcName));
+    dstNames.append(internSymbol(dstName));
+    expressmen.append(internSymbol(expressman));
+    maxRowid = rowid;
+}
+
+bool ItemColumns::update(int id, int cost, int type, int state, int sendingDay, int receivingDay, const QString &srcName, const QString &dstName, const QString &expressman)
+{
+    auto iter = rowOfId.constFind(id);
+    if (iter == rowOfId.constEnd())
+        return false;
+    int row = iter.value();
+    costs[row] = cost;
+    types[row] = type;
+    states[row] = state;
+    sendingDays[row] = sendingDay;
+    receivingDays[row] = receivingDay;
+    srcNames[row] = internSymbol(srcName);
+    dstNames[row] = internSymbol(dstName);
+    expressmen[row] = internSymbol(expressman);
+    return true;
+}
+
+void ItemColumns::remove(int id)
+{
+    auto iter = rowOfId.find(id);
+    if (iter == rowOfId.end())
+        return;
+    ids[iter.value()] = ITEM_COLUMNS_REMOVED;
+    rowOfId.erase(iter);
+    removedRows++;
+    //新插入的行的rowid是表中最大的rowid加一，末尾的行删除后回退到未删除的最后一行
+    int row = ids.size() - 1;
+    while (row >= 0 && ids[row] == ITEM_COLUMNS_REMOVED)
+        row--;
+    maxRowid = row >= 0 ? rowids[row] : 0;
+}
+
+int ItemColumns::removedCount() const
+{
+    return removedRows;
+}
+
+qint64 ItemColumns::lastRowid() const
+{
+    return maxRowid;
+}
+
+int ItemColumns::size() const
+{
+    return ids.size();
+}
+
+qint64 ItemColumns::memoryBytes() const
+{
+    return qint64(ids.capacity()) * 9 * sizeof(qint32) + qint64(rowids.capacity()) * sizeof(qint64);
+}
+
+QVector<int> ItemColumns::filter(const ItemFilter &filter, QThreadPool *pool) const
+{
+    //每个条件化为一列上的闭区间；符号表中没有的用户名不可能匹配任何行
+    QVector<ColumnRange> ranges;
+    if (filter.id != -1)
+        ranges.append(ColumnRange{ids.constData(), filter.id, filter.id});
+    if (filter.state != -1)
+        ranges.append(ColumnRange{states.constData(), filter.state, filter.state});
+    if (filter.sendingFrom != -1 || filter.sendingTo != -1)
+        ranges.append(ColumnRange{sendingDays.constData(), filter.sendingFrom != -1 ? filter.sendingFrom : INT_MIN, filter.sendingTo != -1 ? filter.sendingTo : INT_MAX});
+    if (filter.receivingFrom != -1 || filter.receivingTo != -1)
+        ranges.append(ColumnRange{receivingDays.constData(), filter.receivingFrom != -1 ? filter.receivingFrom : INT_MIN, filter.receivingTo != -1 ? filter.receivingTo : INT_MAX});
+    const QPair<const QString *, const QVector<qint32> *> names[] = {{&filter.srcName, &srcNames}, {&filter.dstName, &dstNames}, {&filter.expressman, &expressmen}};
+    for (const auto &name : names)
+    {
+        if (name.first->isEmpty())
+            continue;
+        int symbol = findSymbol(*name.first);
+        if (symbol == SYMBOL_NONE)
+            return {};
+        ranges.append(ColumnRange{name.second->constData(), symbol, symbol});
+    }
+
+    int rows = ids.size();
+    int chunks = (rows + ITEM_COLUMNS_CHUNK - 1) / ITEM_COLUMNS_CHUNK;
+    QVector<QVector<int>> matches(chunks);
+    QSemaphore done;
+    for (int chunk = 0; chunk < chunks; chunk++)
+    {
+        //每块写自己的结果，块之间不共享任何可写的数据
+        QVector<int> *result = &matches[chunk];
+        pool->start([this, &ranges, &done, result, chunk, rows]()
+                    {
+                        int begin = chunk * ITEM_COLUMNS_CHUNK, count = qMin(ITEM_COLUMNS_CHUNK, rows - begin);
+                        QVector<quint8> selected(count, 1);
+                        for (const ColumnRange &range : ranges)
+                            rangeKernel(range.column + begin, count, range.low, range.high, selected.data());
+                        for (int i = 0; i < count; i++)
+                            if (selected[i] && ids[begin + i] != ITEM_COLUMNS_REMOVED)
+                                result->append(ids[begin + i]);
+                        done.release(); });
+    }
+    done.acquire(chunks);
+
+    QVector<int> result;
+    for (const QVector<int> &chunkMatches : matches)
+        result += chunkMatches;
+    //快照按rowid排列，并发写入时rowid与id的顺序可能不同
+    std::sort(result.begin(), result.end());
+    return result;
+}
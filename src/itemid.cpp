@@ -0,0 +1,75 @@
+﻿/**
+ * @file itemid.cpp
+ * @author Haolin Yang
+ * @brief 物品id分配器的实现
+ * @version 0.1
+ * @date 2022-05-17
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/itemid.h"
+#include <QDebug>
+
+quint64 ItemIdAllocator::pack(int next, int last)
+{
+    return (quint64(quint32(last)) << 32) | quint32(next);
+}
+
+ItemIdAllocator::ItemIdAllocator(const ItemIdLease &_lease, const ItemIdGiveBack &_giveBack, int _blockSize)
+    : lease(_lease), giveBack(_giveBack), blockSize(qMax(1, _blockSize)), block(pack(1, 0)), leases(0)
+{
+}
+
+ItemIdAllocator::~ItemIdAllocator()
+{
+    quint64 current = block.loadAcquire();
+    int next = int(quint32(current)), last = int(current >> 32);
+    if (next <= last)
+        giveBack(next, last);
+}
+
+int ItemIdAllocator::allocate(int count)
+{
+    if (count <= 0)
+        return -1;
+    if (count > blockSize)
+    {
+        //大批量单独租用一段，不打断当前段
+        int first;
+        leases.fetchAndAddRelaxed(1);
+        return lease(count, first) ? first : -1;
+    }
+
+    for (;;)
+    {
+        quint64 current = block.loadAcquire();
+        int next = int(quint32(current)), last = int(current >> 32);
+        if (last - next + 1 >= count)
+        {
+            //段内分配只需一次比较并交换，失败说明其他线程抢先分配，重试即可
+            if (block.testAndSetOrdered(current, pack(next + count, last)))
+                return next;
+            continue;
+        }
+
+        //当前段不够用时租用新段，剩余的id留作空号
+        QMutexLocker locker(&refillMutex);
+        if (block.loadAcquire() != current)
+            continue;
+        int first;
+        leases.fetchAndAddRelaxed(1);
+        if (!lease(blockSize, first))
+        {
+            qCritical() << "物品：租用id失败";
+            return -1;
+        }
+        block.storeRelease(pack(first, first + blockSize - 1));
+    }
+}
+
+int ItemIdAllocator::leaseCount() const
+{
+    return leases.loadRelaxed();
+}
@@ -0,0 +1,152 @@
+﻿/**
+ * @file snapshot.cpp
+ * @author Haolin Yang
+ * @brief 用于快速启动的二进制快照的实现
+ * @version 0.1
+ * @date 2022-05-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/snapshot.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+const quint32 SNAPSHOT_MAGIC = 0x51534e50; //快照文件的标识
+const quint32 SNAPSHOT_VERSION = 2;        //快照格式的版本, 格式变化时递增
+
+FileStamp FileStamp::of(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    if (!info.exists())
+        return FileStamp{fileName, -1, 0};
+    return FileStamp{fileName, info.size(), info.lastModified().toMSecsSinceEpoch()};
+}
+
+//把文件的大小和修改时间写入流，文件不存在时大小记为-1
+static void writeStamp(QDataStream &stream, const QString &fileName)
+{
+    FileStamp stamp = FileStamp::of(fileName);
+    stream << stamp.fileName << stamp.size << stamp.mtime;
+}
+
+static bool checkStamp(QDataStream &stream, const FileStamp &stamp)
+{
+    QString name;
+    qint64 size, mtime;
+    stream >> name >> size >> mtime;
+    if (name != stamp.fileName || size != stamp.size)
+        return false;
+    return size == -1 || mtime == stamp.mtime;
+}
+
+bool BootSnapshot::load(const QString &fileName, const QVector<FileStamp> &watchedStamps, BootSnapshot &snapshot)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    //整个快照一次读入
+    QByteArray bytes = file.readAll();
+    file.close();
+
+    QDataStream header(bytes);
+    quint32 magic, version, length;
+    quint16 checksum;
+    header >> magic >> version >> length >> checksum;
+    if (header.status() != QDataStream::Ok || magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION)
+    {
+        qWarning() << "快照：" << fileName << "格式或版本不符，忽略";
+        return false;
+    }
+    const int headerSize = 14;
+    if (int(length) != bytes.size() - headerSize || qChecksum(bytes.constData() + headerSize, length) != checksum)
+    {
+        qWarning() << "快照：" << fileName << "校验失败，忽略";
+        return false;
+    }
+
+    QDataStream stream(bytes.mid(headerSize));
+    stream.setVersion(QDataStream::Qt_5_15);
+    qint32 stampCount;
+    stream >> stampCount;
+    if (stampCount != watchedStamps.size())
+        return false;
+    for (const FileStamp &watched : watchedStamps)
+        if (!checkStamp(stream, watched))
+        {
+            qInfo() << "快照：" << watched.fileName << "在快照之后被修改，快照已过期";
+            return false;
+        }
+
+    qint32 userStorage, userLogCount, usernameCount, userCount;
+    stream >> userStorage >> userLogCount >> usernameCount;
+    snapshot.userStorage = userStorage;
+    snapshot.userLogCount = userLogCount;
+    snapshot.usernames.reserve(usernameCount);
+    for (int i = 0; i < usernameCount; i++)
+    {
+        QString username;
+        stream >> username;
+        snapshot.usernames.insert(username);
+    }
+    stream >> userCount;
+    snapshot.users.reserve(userCount);
+    for (int i = 0; i < userCount; i++)
+    {
+        QString username;
+        UserRecord record;
+        qint32 type, balance;
+        stream >> username >> record.password >> type >> balance >> record.name >> record.phoneNumber >> record.address;
+        record.type = type;
+        record.balance = balance;
+        snapshot.users.insert(username, record);
+    }
+    if (stream.status() != QDataStream::Ok)
+    {
+        qWarning() << "快照：" << fileName << "内容不完整，忽略";
+        return false;
+    }
+    qInfo() << "快照：载入" << snapshot.usernames.size() + snapshot.users.size() << "个用户";
+    return true;
+}
+
+bool BootSnapshot::save(const QString &fileName, const QStringList &watchedFiles) const
+{
+    QByteArray payload;
+    {
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_15);
+        stream << qint32(watchedFiles.size());
+        for (const QString &watched : watchedFiles)
+            writeStamp(stream, watched);
+        stream << qint32(userStorage) << qint32(userLogCount) << qint32(usernames.size());
+        for (const QString &username : usernames)
+            stream << username;
+        stream << qint32(users.size());
+        for (auto i = users.constBegin(); i != users.constEnd(); i++)
+            stream << i.key() << i.value().password << qint32(i.value().type) << qint32(i.value().balance) << i.value().name << i.value().phoneNumber << i.value().address;
+    }
+
+    QString tempFileName = fileName + ".tmp";
+    QFile file(tempFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qCritical() << "快照：写入失败" << file.errorString();
+        return false;
+    }
+    QDataStream header(&file);
+    header << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << quint32(payload.size()) << qChecksum(payload.constData(), payload.size());
+    file.write(payload);
+    file.close();
+
+    QDir dir;
+    dir.remove(fileName);
+    dir.rename(tempFileName, fileName);
+    qInfo() << "快照：写入" << usernames.size() + users.size() << "个用户";
+    return true;
+}
@@ -0,0 +1,91 @@
+﻿/**
+ * @file symbol.cpp
+ * @author Haolin Yang
+ * @brief 进程内共享的用户名符号表的实现
+ * @version 0.1
+ * @date 2022-05-22
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/symbol.h"
+#include <QDebug>
+#include <QtAlgorithms>
+#include <climits>
+
+//符号所在的块: 第k块从((2^k)-1)<<SYMBOL_CHUNK_BITS开始
+static inline int chunkOf(int symbol)
+{
+    return 31 - qCountLeadingZeroBits(quint32((symbol >> SYMBOL_CHUNK_BITS) + 1));
+}
+
+//符号在块内的下标
+static inline int offsetOf(int symbol, int chunk)
+{
+    return symbol - int(((1u << chunk) - 1) << SYMBOL_CHUNK_BITS);
+}
+
+SymbolTable &SymbolTable::instance()
+{
+    static SymbolTable table;
+    return table;
+}
+
+SymbolTable::SymbolTable() : chunks{}, count(0)
+{
+    intern(QString());
+}
+
+SymbolTable::~SymbolTable()
+{
+    for (QString *chunk : chunks)
+        delete[] chunk;
+}
+
+int SymbolTable::find(const QString &name) const
+{
+    QReadLocker locker(&lock);
+    return symbols.value(name, SYMBOL_NONE);
+}
+
+int SymbolTable::intern(const QString &name)
+{
+    int symbol = find(name);
+    if (symbol != SYMBOL_NONE)
+        return symbol;
+
+    QWriteLocker locker(&lock);
+    //加写锁之前可能已被其他线程分配
+    symbol = symbols.value(name, SYMBOL_NONE);
+    if (symbol != SYMBOL_NONE)
+        return symbol;
+    symbol = count.loadRelaxed();
+    //最后一个int值留给count，内存会先于符号耗尽
+    if (symbol == INT_MAX)
+    {
+        qCritical() << "符号表：用户名数量超出上限";
+        return SYMBOL_NONE;
+    }
+    int chunk = chunkOf(symbol);
+    if (!chunks[chunk])
+        chunks[chunk] = new QString[size_t(1) << (SYMBOL_CHUNK_BITS + chunk)];
+    chunks[chunk][offsetOf(symbol, chunk)] = name;
+    symbols.insert(name, symbol);
+    count.storeRelease(symbol + 1);
+    return symbol;
+}
+
+const QString &SymbolTable::name(int symbol) const
+{
+    static const QString empty;
+    if (symbol < 0 || symbol >= count.loadAcquire())
+        return empty;
+    int chunk = chunkOf(symbol);
+    return chunks[chunk][offsetOf(symbol, chunk)];
+}
+
+int SymbolTable::size() const
+{
+    return count.loadAcquire();
+}
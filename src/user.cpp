@@ -10,11 +10,12 @@
  */
 
 #include "../include/user.h"
+#include <QDate>
 #include <string>
 
-void User::insertInfo2DB(Database *db)
+bool User::insertInfo2DB(Database *db)
 {
-    db->insertUser(username, password, type, 0, name, phoneNumber, address);
+    return db->insertUser(username, password, type, 0, name, phoneNumber, address);
 }
 
 // int Administrator::queryAllUserInfo(QList<QSharedPointer<User>> &result, Database *db) const
@@ -22,21 +23,18 @@ void User::insertInfo2DB(Database *db)
 //     return db->queryAllUser(result);
 // }
 
-QString UserManage::verify(const QJsonObject &token) const
+QSharedPointer<User> UserManage::verify(const QJsonObject &token) const
 {
-    if (!token.contains("username") ||
-        !userMap.value(token["username"].toString(), nullptr) ||
-        !token.contains("iss") ||
-        token["iss"] != "Haolin Yang")
+    QSharedPointer<User> user;
+    if (token.contains("username") && token.contains("iss") && token["iss"] == "Haolin Yang")
+        user = userMap.value(findSymbol(token["username"].toString()));
+    if (!user)
     {
         qWarning() << "用户验证失败";
         return {};
     }
-    else
-    {
-        qDebug() << "用户 " << token["username"].toString() << " 验证成功，类型为" << userMap[token["username"].toString()]->getUserType();
-        return token["username"].toString();
-    }
+    qDebug() << "用户 " << user->getUsername() << " 验证成功，类型为" << user->getUserType();
+    return user;
 }
 
 QString UserManage::addBalance(const QJsonObject &token, int addend) const
@@ -44,23 +42,25 @@ QString UserManage::addBalance(const QJsonObject &token, int addend) const
     if (addend > (int)1e9 || addend < (int)-1e9)
         return "单次余额改变量不能超过1000000000";
 
-    QString username = verify(token);
-    if (username.isEmpty())
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
+    const QString &username = caller->getUsername();
 
-    if (userMap[username]->getBalance() + addend < 0)
+    if (caller->getBalance() + addend < 0)
         return "余额不能为负";
 
-    if (userMap[username]->getBalance() + addend > (int)1e9)
+    if (caller->getBalance() + addend > (int)1e9)
         return "余额上限为1000000000";
 
-    qDebug() << "修改用户 " << username << " 成功, 余额为 " << userMap[username]->getBalance() + addend;
-    db->modifyUserBalance(username, userMap[username]->getBalance() + addend);
-    userMap[username]->addBalance(addend);
+    qDebug() << "修改用户 " << username << " 成功, 余额为 " << caller->getBalance() + addend;
+    if (!db->modifyUserBalance(username, caller->getBalance() + addend))
+        return "修改余额失败";
+    caller->addBalance(addend);
     return {};
 }
 
-QString UserManage::transferBalance(const QJsonObject &token, int balance, const QString &dstUser) const
+QString UserManage::transferBalance(const QSharedPointer<User> &caller, int balance, const QString &dstUser) const
 {
     if (balance >= (int)1e9 || balance <= (int)-1e9)
         return "单次余额改变量不能超过1000000000";
@@ -75,95 +75,269 @@ QString UserManage::transferBalance(const QJsonObject &token, int balance, const
     if (dstBalance + balance < 0)
         return "对方余额不能小于0";
 
-    QString ret = addBalance(token, -balance);
-    if (!ret.isEmpty())
-        return ret;
+    const QString &username = caller->getUsername();
+
+    int srcBalance = caller->getBalance() - balance;
+    if (srcBalance < 0)
+        return "余额不能为负";
+
+    if (srcBalance > (int)1e9)
+        return "余额上限为1000000000";
+
+    if (username == dstUser)
+        return {};
+
+    //双方余额一起修改，sqlite存储时在同一个事务中完成
+    QMap<QString, int> balances;
+    balances.insert(username, srcBalance);
+    balances.insert(dstUser, dstBalance + balance);
+    if (!db->modifyUserBalances(balances))
+        return "转账失败";
 
-    db->modifyUserBalance(dstUser, dstBalance + balance);
+    caller->addBalance(-balance);
     qDebug() << dstUser << "获得金额: " << balance;
     return {};
 }
 
-QString UserManage::queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret) const
+//把按年、月、日给出的日期条件和日期范围合并为日期键的闭区间
+//没有给出年时月、日无法化为区间，放在month、monthDay中单独比较；给出年和日而没有月时日也单独比较
+static QString parseDateFilter(const QJsonObject &filter, const QString &prefix, const QString &fromKey, const QString &toKey, int &from, int &to, int &month, int &monthDay)
 {
-    bool ok;
-    if (!filter.contains("type"))
-        return "缺少type键";
-    int cnt;
-
-    QString username = verify(token);
-    if (filter["type"].toInt() == 0 && userMap[username]->getUserType() != ADMINISTRATOR)
-        return "非管理员不能查看所有物品";
+    bool hasMonth = filter.contains(prefix + "_Month"), hasDay = filter.contains(prefix + "_Day");
+    if (hasMonth && (filter[prefix + "_Month"].toInt() < 1 || filter[prefix + "_Month"].toInt() > 12))
+        return prefix + "_Month的值应在1~12之间";
+    if (hasDay && (filter[prefix + "_Day"].toInt() < 1 || filter[prefix + "_Day"].toInt() > 31))
+        return prefix + "_Day的值应在1~31之间";
+    if (filter.contains(prefix + "_Year"))
+    {
+        int year = filter[prefix + "_Year"].toInt();
+        if (hasMonth)
+        {
+            from = year * 10000 + filter[prefix + "_Month"].toInt() * 100;
+            to = from + 99;
+            if (hasDay)
+                from = to = from + filter[prefix + "_Day"].toInt();
+        }
+        else
+        {
+            from = year * 10000;
+            to = from + 9999;
+            if (hasDay)
+                monthDay = filter[prefix + "_Day"].toInt();
+        }
+    }
+    else
+    {
+        if (hasMonth)
+            month = filter[prefix + "_Month"].toInt();
+        if (hasDay)
+            monthDay = filter[prefix + "_Day"].toInt();
+    }
 
-    QList<QSharedPointer<Item>> result;
+    if (filter.contains(fromKey))
+        from = qMax(from, filter[fromKey].toInt());
+    if (filter.contains(toKey))
+        to = to == -1 ? filter[toKey].toInt() : qMin(to, filter[toKey].toInt());
+    return {};
+}
 
-    int id = -1, state = -1;
-    Time sendingTime(-1, -1, -1), receivingTime(-1, -1, -1);
-    QString srcName(""), dstName(""), expressman("");
+//把Json格式的查询条件转换为ItemFilter
+static QString parseItemFilter(const QJsonObject &filter, ItemFilter &itemFilter)
+{
     if (filter.contains("id"))
-        id = filter["id"].toInt();
+        itemFilter.id = filter["id"].toInt();
     if (filter.contains("state"))
-        state = filter["state"].toInt();
-    if (filter.contains("sendingTime_Year"))
-        sendingTime.year = filter["sendingTime_Year"].toInt();
-    if (filter.contains("sendingTime_Month"))
-        sendingTime.month = filter["sendingTime_Month"].toInt();
-    if (filter.contains("sendingTime_Day"))
-        sendingTime.day = filter["sendingTime_Day"].toInt();
-    if (filter.contains("receivingTime_Year"))
-        receivingTime.year = filter["receivingTime_Year"].toInt();
-    if (filter.contains("receivingTime_Month"))
-        receivingTime.month = filter["receivingTime_Month"].toInt();
-    if (filter.contains("receivingTime_Day"))
-        receivingTime.day = filter["receivingTime_Day"].toInt();
+        itemFilter.state = filter["state"].toInt();
+    QString error = parseDateFilter(filter, "sendingTime", "sendingFrom", "sendingTo", itemFilter.sendingFrom, itemFilter.sendingTo, itemFilter.sendingMonth, itemFilter.sendingMonthDay);
+    if (error.isEmpty())
+        error = parseDateFilter(filter, "receivingTime", "receivingFrom", "receivingTo", itemFilter.receivingFrom, itemFilter.receivingTo, itemFilter.receivingMonth, itemFilter.receivingMonthDay);
+    if (!error.isEmpty())
+        return error;
     if (filter.contains("srcName"))
-        srcName = filter["srcName"].toString();
+        itemFilter.srcName = filter["srcName"].toString();
     if (filter.contains("dstName"))
-        dstName = filter["dstName"].toString();
+        itemFilter.dstName = filter["dstName"].toString();
     if (filter.contains("expressman"))
-        expressman = filter["expressman"].toString();
+        itemFilter.expressman = filter["expressman"].toString();
+    itemFilter.includeArchived = filter["archived"].toBool();
+    return {};
+}
 
-    switch (filter["type"].toInt())
+//按查询类型把查询范围限定为当前用户寄出、收到或派送的物品
+static QString scopeItemFilter(int type, const QString &username, ItemFilter &itemFilter)
+{
+    switch (type)
     {
     case 0:
-        cnt = itemManage->queryByFilter(result, id, state, sendingTime, receivingTime, srcName, dstName, expressman);
         break;
     case 1:
-        cnt = itemManage->queryByFilter(result, id, state, sendingTime, receivingTime, username, dstName, expressman);
+        itemFilter.srcName = username;
         break;
     case 2:
-        cnt = itemManage->queryByFilter(result, id, state, sendingTime, receivingTime, srcName, username, expressman);
+        itemFilter.dstName = username;
         break;
     case 3:
-        cnt = itemManage->queryByFilter(result, id, state, sendingTime, receivingTime, srcName, dstName, username);
+        itemFilter.expressman = username;
         break;
     default:
         return "type键的值有误";
         break;
     }
+    return {};
+}
+
+QString UserManage::queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret) const
+{
+    QString nextCursor;
+    return queryItem(token, filter, ret, nextCursor);
+}
+
+QString UserManage::queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret, QString &nextCursor) const
+{
+    return visitItem(
+        token, filter, [&ret](const QJsonObject &item)
+        {
+            ret.append(item);
+            return true; },
+        nextCursor);
+}
+
+QString UserManage::visitItem(const QJsonObject &token, const QJsonObject &filter, const std::function<bool(const QJsonObject &)> &visitor, QString &nextCursor) const
+{
+    if (!filter.contains("type"))
+        return "缺少type键";
+    int cnt;
 
-    for (const QSharedPointer<Item> &item : result)
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
+        return "验证失败";
+    const QString &username = caller->getUsername();
+    if (filter["type"].toInt() == 0 && caller->getUserType() != ADMINISTRATOR)
+        return "非管理员不能查看所有物品";
+
+    ItemFilter itemFilter;
+    QString error = parseItemFilter(filter, itemFilter);
+    if (!error.isEmpty())
+        return error;
+
+    error = scopeItemFilter(filter["type"].toInt(), username, itemFilter);
+    if (!error.isEmpty())
+        return error;
+    ItemPage page;
+    if (filter.contains("limit"))
+        page.limit = filter["limit"].toInt();
+    if (filter.contains("orderBy"))
     {
-        QJsonObject itemJson;
-        itemJson.insert("id", item->getId());
-        itemJson.insert("cost", item->getCost());
-        itemJson.insert("type", item->getType());
-        itemJson.insert("state", item->getState());
-        itemJson.insert("sendingTime_Year", item->getSendingTime().year);
-        itemJson.insert("sendingTime_Month", item->getSendingTime().month);
-        itemJson.insert("sendingTime_Day", item->getSendingTime().day);
-        itemJson.insert("receivingTime_Year", item->getReceivingTime().year);
-        itemJson.insert("receivingTime_Month", item->getReceivingTime().month);
-        itemJson.insert("receivingTime_Day", item->getReceivingTime().day);
-        itemJson.insert("srcName", item->getSrcName());
-        itemJson.insert("dstName", item->getDstName());
-        itemJson.insert("expressman", item->getExpressman());
-        itemJson.insert("description", item->getDescription());
-        ret.append(itemJson);
+        if (filter["orderBy"].toString() == "sendingDay")
+            page.orderBy = ITEM_ORDER_SENDING_DAY;
+        else if (filter["orderBy"].toString() != "id")
+            return "orderBy键的值有误";
+    }
+    page.descending = filter["descending"].toBool();
+    page.cursor = filter["cursor"].toString();
+    //每一批扁平记录逐行转换为Json后立即交给visitor，不构造Item对象，也不保存整个结果
+    cnt = itemManage->visitRecords(
+        itemFilter, page, [&visitor](const ItemBatch &batch, const ItemRecord &item)
+        {
+            Time sendingTime = Time::fromDayKey(item.sendingDay), receivingTime = Time::fromDayKey(item.receivingDay);
+            QJsonObject itemJson;
+            itemJson.insert("id", item.id);
+            itemJson.insert("cost", item.cost);
+            itemJson.insert("type", item.type);
+            itemJson.insert("state", item.state);
+            itemJson.insert("sendingTime_Year", sendingTime.year);
+            itemJson.insert("sendingTime_Month", sendingTime.month);
+            itemJson.insert("sendingTime_Day", sendingTime.day);
+            itemJson.insert("receivingTime_Year", receivingTime.year);
+            itemJson.insert("receivingTime_Month", receivingTime.month);
+            itemJson.insert("receivingTime_Day", receivingTime.day);
+            itemJson.insert("srcName", symbolName(item.srcName));
+            itemJson.insert("dstName", symbolName(item.dstName));
+            itemJson.insert("expressman", symbolName(item.expressman));
+            itemJson.insert("description", batch.text(item.description));
+            return visitor(itemJson); },
+        nextCursor);
+    if (cnt < 0)
+        return "游标无效";
+    return {};
+}
+
+QString UserManage::aggregateItem(const QJsonObject &token, const QJsonObject &filter, const QString &groupBy, QJsonArray &ret) const
+{
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
+        return "验证失败";
+    if (caller->getUserType() != ADMINISTRATOR)
+        return "非管理员不能统计物品";
+
+    static const QStringList groupNames{"", "state", "type", "expressman", "sendingDay", "receivingDay"};
+    int group = groupNames.indexOf(groupBy);
+    if (group == -1)
+        return "groupBy的值有误";
+    ItemFilter itemFilter;
+    QString error = parseItemFilter(filter, itemFilter);
+    if (!error.isEmpty())
+        return error;
+
+    QVector<ItemAggregate> result;
+    if (!itemManage->aggregate(itemFilter, group, result))
+        return "统计失败";
+    for (const ItemAggregate &aggregate : result)
+    {
+        QJsonObject row;
+        if (group != ITEM_GROUP_NONE)
+            row.insert("key", QJsonValue::fromVariant(aggregate.key));
+        row.insert("count", aggregate.count);
+        row.insert("costSum", aggregate.costSum);
+        ret.append(row);
     }
     return {};
 }
 
+QString UserManage::searchItem(const QJsonObject &token, const QString &text, const QJsonObject &filter, QJsonArray &ret) const
+{
+    if (!filter.contains("type"))
+        return "缺少type键";
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
+        return "验证失败";
+    const QString &username = caller->getUsername();
+    if (filter["type"].toInt() == 0 && caller->getUserType() != ADMINISTRATOR)
+        return "非管理员不能搜索所有物品";
+
+    ItemFilter itemFilter;
+    QString error = parseItemFilter(filter, itemFilter);
+    if (error.isEmpty())
+        error = scopeItemFilter(filter["type"].toInt(), username, itemFilter);
+    if (!error.isEmpty())
+        return error;
+
+    QVector<int> ids;
+    if (itemManage->search(text, itemFilter, filter["limit"].toInt(), ids) < 0)
+        return "搜索不可用";
+    for (int id : ids)
+        ret.append(id);
+    return {};
+}
+
+QString UserManage::archiveItem(const QJsonObject &token, int days, int &count) const
+{
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
+        return "验证失败";
+    if (caller->getUserType() != ADMINISTRATOR)
+        return "非管理员不能归档物品";
+    if (days < 0)
+        return "天数不能为负";
+
+    //以物流系统时间为准，接收日期早于今天减去days天的已签收物品被归档
+    QDate cutoff = QDate(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay()).addDays(-days);
+    count = itemManage->archive(Time(cutoff.year(), cutoff.month(), cutoff.day()).toDayKey());
+    if (count < 0)
+        return "归档失败";
+    return {};
+}
+
 QString UserManage::registerUser(const QJsonObject &token, const QString &username, const QString &password, int type, const QString &name, const QString &phoneNumber, const QString &address) const
 {
     if (username.isEmpty() || username.size() > 10)
@@ -181,22 +355,74 @@ QString UserManage::registerUser(const QJsonObject &token, const QString &userna
         return "管理员类不支持注册";
         break;
     case EXPRESSMAN:
-        if (verify(token).isEmpty() || userMap[verify(token)]->getUserType() != ADMINISTRATOR)
+    {
+        QSharedPointer<User> caller = verify(token);
+        if (!caller || caller->getUserType() != ADMINISTRATOR)
             return "只有管理员类才能注册快递员";
         user = QSharedPointer<Expressman>::create(username, password, 0, name, phoneNumber, address);
         break;
     }
+    }
 
-    user->insertInfo2DB(db);
+    if (!user->insertInfo2DB(db))
+        return "注册失败";
 
     qDebug() << username << " 注册成功";
     return {};
 }
 
+QString UserManage::registerUsers(const QJsonObject &token, const QJsonArray &rows, QJsonArray &failures) const
+{
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
+        return "验证失败";
+    if (caller->getUserType() != ADMINISTRATOR)
+        return "只有管理员才能批量注册";
+
+    QList<QPair<QString, UserRecord>> users;
+    QList<int> rowOfUser;
+    auto addFailure = [&failures](int row, const QString &name, const QString &error)
+    {
+        QJsonObject failure;
+        failure.insert("row", row);
+        failure.insert("username", name);
+        failure.insert("error", error);
+        failures.append(failure);
+    };
+
+    for (int i = 0; i < rows.size(); i++)
+    {
+        QJsonObject row = rows[i].toObject();
+        QString name = row["username"].toString();
+        int type = row.contains("type") ? row["type"].toInt() : CUSTOMER;
+        if (!row.contains("password") || !row.contains("name") || !row.contains("phonenumber") || !row.contains("address"))
+            addFailure(i, name, "用户信息不全");
+        else if (name.isEmpty() || name.size() > 10)
+            addFailure(i, name, "用户名长度应该在1~10之间");
+        else if (type != CUSTOMER && type != EXPRESSMAN)
+            addFailure(i, name, "只能注册用户或快递员");
+        else
+        {
+            users.append(qMakePair(name, UserRecord{row["password"].toString(), type, 0, row["name"].toString(), row["phonenumber"].toString(), row["address"].toString()}));
+            rowOfUser.append(i);
+        }
+    }
+
+    QMap<int, QString> dbFailures;
+    int cnt = db->insertUsers(users, dbFailures);
+    for (auto i = dbFailures.constBegin(); i != dbFailures.constEnd(); i++)
+        addFailure(rowOfUser[i.key()], users[i.key()].first, i.value());
+
+    qDebug() << "批量注册成功" << cnt << "个，失败" << failures.size() << "个";
+    return {};
+}
+
 QString UserManage::deleteExpressman(const QJsonObject &token, const QString &expressman) const
 {
-    QString username = verify(token);
-    if (userMap[username]->getUserType() != ADMINISTRATOR)
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
+        return "验证失败";
+    if (caller->getUserType() != ADMINISTRATOR)
         return "非管理员不能删除快递员";
 
     QSharedPointer<User> user = db->queryUserByName(expressman);
@@ -217,7 +443,7 @@ QString UserManage::login(const QString &username, const QString &password, QJso
     QSharedPointer<User> user = db->queryUserByName(username);
     if (user && user->getPassword() == password)
     {
-        userMap[username] = user;
+        userMap[internSymbol(username)] = user;
         token.insert("iss", "Haolin Yang");
         token.insert("username", username);
         return {};
@@ -228,50 +454,59 @@ QString UserManage::login(const QString &username, const QString &password, QJso
 
 QString UserManage::logout(const QJsonObject &token)
 {
-    QString username = verify(token);
-    if (username.isEmpty())
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
+    const QString &username = caller->getUsername();
     qDebug() << "用户 " << username << " 登出";
-    userMap.remove(username);
+    userMap.remove(findSymbol(username));
     return {};
 }
 
 QString UserManage::changePassword(const QJsonObject &token, const QString &newPassword) const
 {
-    QString username = verify(token);
-    if (username.isEmpty())
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
+    const QString &username = caller->getUsername();
     qDebug() << "用户 " << username << " 修改密码为 " << newPassword;
-    db->modifyUserPassword(username, newPassword);
+    if (!db->modifyUserPassword(username, newPassword))
+        return "修改密码失败";
     return {};
 }
 
 QString UserManage::getUserInfo(const QJsonObject &token, QJsonObject &ret) const
 {
-    QString username = verify(token);
-    if (username.isEmpty())
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
+    const QString &username = caller->getUsername();
     qDebug() << "获取用户" << username << " 的信息";
     ret.insert("username", username);
-    ret.insert("type", userMap[username]->getUserType());
-    ret.insert("balance", userMap[username]->getBalance());
-    ret.insert("name", userMap[username]->getName());
-    ret.insert("phonenumber", userMap[username]->getPhoneNumber());
-    ret.insert("address", userMap[username]->getAddress());
+    ret.insert("type", caller->getUserType());
+    ret.insert("balance", caller->getBalance());
+    ret.insert("name", caller->getName());
+    ret.insert("phonenumber", caller->getPhoneNumber());
+    ret.insert("address", caller->getAddress());
     return {};
 }
 
 QString UserManage::queryAllUserInfo(const QJsonObject &token, QJsonArray &ret) const
 {
-    QString username = verify(token);
-    if (username.isEmpty())
+    return queryAllUserInfo(token, "", -1, ret);
+}
+
+QString UserManage::queryAllUserInfo(const QJsonObject &token, const QString &afterUsername, int limit, QJsonArray &ret) const
+{
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
-    if (userMap[username]->getUserType() != ADMINISTRATOR)
+    if (caller->getUserType() != ADMINISTRATOR)
         return "非管理员不能查看所有用户信息";
 
     QList<QSharedPointer<User>> result;
 
-    db->queryAllUser(result);
+    db->queryUserPage(result, afterUsername, limit);
 
     for (const QSharedPointer<User> &user : result)
     {
@@ -289,10 +524,11 @@ QString UserManage::queryAllUserInfo(const QJsonObject &token, QJsonArray &ret)
 
 QString UserManage::sendItem(const QJsonObject &token, const QJsonObject &info) const
 {
-    QString username = verify(token);
-    if (username.isEmpty())
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
-    if (userMap[username]->getUserType() != CUSTOMER)
+    const QString &username = caller->getUsername();
+    if (caller->getUserType() != CUSTOMER)
         return "非用户不能发出快递";
 
     if (!info.contains("dstName") || !info.contains("type") || !info.contains("amount") || !info.contains("description"))
@@ -321,7 +557,7 @@ QString UserManage::sendItem(const QJsonObject &token, const QJsonObject &info)
         return "快递类型有误";
     }
 
-    QString ret = transferBalance(token, cost, "admin");
+    QString ret = transferBalance(caller, cost, "admin");
     if (!ret.isEmpty())
         return ret;
 
@@ -334,10 +570,11 @@ QString UserManage::sendItem(const QJsonObject &token, const QJsonObject &info)
 
 QString UserManage::deliveryItem(const QJsonObject &token, const QJsonObject &info) const
 {
-    QString username = verify(token);
-    if (username.isEmpty())
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
-    if (userMap[username]->getUserType() != EXPRESSMAN)
+    const QString &username = caller->getUsername();
+    if (caller->getUserType() != EXPRESSMAN)
         return "非快递员不能运送快递";
 
     if (!info.contains("itemId"))
@@ -348,25 +585,28 @@ QString UserManage::deliveryItem(const QJsonObject &token, const QJsonObject &in
         return "不存在运单号为该ID的物品";
     if (result->getState() != PENDING_COLLECTING)
         return "该快递已发出";
-    if (result->getExpressman() != username)
+    if (result->getExpressmanSymbol() != findSymbol(username))
         return "这不是你所属的快递";
 
-    QString ret = transferBalance(token, -(result->getCost() / 2), "admin");
+    //先按预期状态转换，转换成功才付运费；付款失败时再转换回去
+    if (!itemManage->transition(info["itemId"].toInt(), PENDING_COLLECTING, PENDING_REVEICING))
+        return "该快递已发出";
+    QString ret = transferBalance(caller, -(result->getCost() / 2), "admin");
     if (!ret.isEmpty())
+    {
+        itemManage->transition(info["itemId"].toInt(), PENDING_REVEICING, PENDING_COLLECTING);
         return ret;
-
-    if (itemManage->modifyState(info["itemId"].toInt(), PENDING_REVEICING))
-        return {};
-    else
-        return "修改失败";
+    }
+    return {};
 }
 
 QString UserManage::receiveItem(const QJsonObject &token, const QJsonObject &info) const
 {
-    QString username = verify(token);
-    if (username.isEmpty())
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
-    if (userMap[username]->getUserType() != CUSTOMER)
+    const QString &username = caller->getUsername();
+    if (caller->getUserType() != CUSTOMER)
         return "非用户不能接收快递";
 
     if (!info.contains("id"))
@@ -375,14 +615,14 @@ QString UserManage::receiveItem(const QJsonObject &token, const QJsonObject &inf
     QSharedPointer<Item> result;
     if (!itemManage->queryById(result, info["id"].toInt()))
         return "不存在运单号为该ID的物品";
-    if (result->getDstName() != username)
+    if (result->getDstSymbol() != findSymbol(username))
         return "这不是您的快递";
     if (result->getState() == PENDING_COLLECTING)
         return "该快递还未到达";
     if (result->getState() == RECEIVED)
         return "该快递已签收";
 
-    if (itemManage->modifyState(info["id"].toInt(), RECEIVED) && itemManage->modifyReceivingTime(info["id"].toInt(), Time(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay())))
+    if (itemManage->transition(info["id"].toInt(), PENDING_REVEICING, RECEIVED, Time(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay())))
         return {};
     else
         return "接收失败";
@@ -390,10 +630,10 @@ QString UserManage::receiveItem(const QJsonObject &token, const QJsonObject &inf
 
 QString UserManage::assignExpressman(const QJsonObject &token, const QJsonObject &info) const
 {
-    QString username = verify(token);
-    if (username.isEmpty())
+    QSharedPointer<User> caller = verify(token);
+    if (!caller)
         return "验证失败";
-    if (userMap[username]->getUserType() != ADMINISTRATOR)
+    if (caller->getUserType() != ADMINISTRATOR)
         return "非管理员不能为快递指定快递员";
 
     if (!info.contains("expressman") || !info.contains("itemId"))
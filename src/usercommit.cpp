@@ -0,0 +1,161 @@
+﻿/**
+ * @file usercommit.cpp
+ * @author Haolin Yang
+ * @brief 用户变更的组提交队列的实现
+ * @version 0.1
+ * @date 2022-05-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/usercommit.h"
+#include <QDebug>
+
+UserCommitQueue::UserCommitQueue(std::function<bool(const QList<UserChange> &)> _writer, std::function<void()> _onWriterExit, int _interval, int _batchSize, bool _flushOnAck)
+    : writer(_writer), onWriterExit(_onWriterExit), interval(qMax(0, _interval)), batchSize(qMax(1, _batchSize)), flushOnAck(_flushOnAck),
+      submittedSeq(0), durableSeq(0), flushRequested(false), stopping(false)
+{
+    writerThread = QThread::create([this]()
+                                   { run(); });
+    writerThread->start();
+    qDebug() << "用户组提交：刷新间隔" << interval << "毫秒，批大小" << batchSize << (flushOnAck ? "，每次提交等待写入完成" : "");
+}
+
+UserCommitQueue::~UserCommitQueue()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        writerCondition.wakeOne();
+    }
+    writerThread->wait();
+    delete writerThread;
+}
+
+bool UserCommitQueue::submit(const QList<UserChange> &changes)
+{
+    QMutexLocker locker(&mutex);
+    if (queue.isEmpty())
+        firstPending.start();
+    for (const UserChange &change : changes)
+    {
+        //同一用户的变更合并为最后一次
+        auto iter = queueIndex.constFind(change.username);
+        if (iter != queueIndex.constEnd())
+            queue[iter.value()] = change;
+        else
+        {
+            queueIndex.insert(change.username, queue.size());
+            queue.append(change);
+        }
+    }
+    qint64 seq = ++submittedSeq;
+    if (flushOnAck)
+        flushRequested = true;
+    writerCondition.wakeOne();
+
+    if (!flushOnAck)
+        return true;
+
+    waitingSeqs[seq]++;
+    while (durableSeq < seq)
+        durableCondition.wait(&mutex);
+    //包含seq的是最大序号不小于seq的第一批
+    auto result = batchResults.lowerBound(seq);
+    bool ok = result == batchResults.end() || result.value();
+    if (--waitingSeqs[seq] == 0)
+        waitingSeqs.remove(seq);
+    //更早的批已没有等待者
+    qint64 oldest = waitingSeqs.isEmpty() ? submittedSeq + 1 : waitingSeqs.firstKey();
+    while (!batchResults.isEmpty() && batchResults.firstKey() < oldest)
+        batchResults.erase(batchResults.begin());
+    return ok;
+}
+
+void UserCommitQueue::recordResult(qint64 batchSeq, bool ok)
+{
+    if (!waitingSeqs.isEmpty())
+        batchResults.insert(batchSeq, ok);
+}
+
+void UserCommitQueue::flush()
+{
+    QMutexLocker locker(&mutex);
+    qint64 seq = submittedSeq;
+    if (durableSeq >= seq)
+        return;
+    flushRequested = true;
+    writerCondition.wakeOne();
+    while (durableSeq < seq)
+        durableCondition.wait(&mutex);
+}
+
+bool UserCommitQueue::pending(const QString &username, UserChange &change) const
+{
+    QMutexLocker locker(&mutex);
+    auto iter = queueIndex.constFind(username);
+    if (iter != queueIndex.constEnd())
+    {
+        change = queue[iter.value()];
+        return true;
+    }
+    auto inflightIter = inflight.constFind(username);
+    if (inflightIter != inflight.constEnd())
+    {
+        change = inflightIter.value();
+        return true;
+    }
+    return false;
+}
+
+void UserCommitQueue::run()
+{
+    QMutexLocker locker(&mutex);
+    while (true)
+    {
+        while (!stopping && !flushRequested && (queue.isEmpty() || (queue.size() < batchSize && firstPending.elapsed() < interval)))
+        {
+            if (queue.isEmpty())
+                writerCondition.wait(&mutex);
+            else
+                writerCondition.wait(&mutex, (unsigned long)qMax<qint64>(1, interval - firstPending.elapsed()));
+        }
+
+        if (queue.isEmpty())
+        {
+            //此前提交的都已写完
+            flushRequested = false;
+            if (durableSeq < submittedSeq)
+                recordResult(submittedSeq, true);
+            durableSeq = submittedSeq;
+            durableCondition.wakeAll();
+            if (stopping)
+                break;
+            continue;
+        }
+
+        QList<UserChange> batch;
+        batch.swap(queue);
+        queueIndex.clear();
+        for (const UserChange &change : batch)
+            inflight.insert(change.username, change);
+        qint64 batchSeq = submittedSeq;
+        flushRequested = false;
+
+        locker.unlock();
+        bool ok = writer(batch);
+        if (!ok)
+            qCritical() << "用户组提交：写入失败，共" << batch.size() << "条变更";
+        locker.relock();
+
+        inflight.clear();
+        recordResult(batchSeq, ok);
+        durableSeq = batchSeq;
+        durableCondition.wakeAll();
+    }
+    locker.unlock();
+
+    if (onWriterExit)
+        onWriterExit();
+}
@@ -0,0 +1,365 @@
+﻿/**
+ * @file userlog.cpp
+ * @author Haolin Yang
+ * @brief 日志结构的用户存储的实现
+ * @version 0.1
+ * @date 2022-05-08
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/userlog.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
+#include <cstring>
+
+//在[begin, end)中查找分隔符，找不到时返回end。memchr在主流C库中都是向量化实现。
+static const char *findDelimiter(const char *begin, const char *end, char delimiter)
+{
+    const char *p = static_cast<const char *>(memchr(begin, delimiter, end - begin));
+    return p ? p : end;
+}
+
+//直接从字节解析整数，避免先构造QString
+static int parseInt(const char *begin, const char *end, bool &ok)
+{
+    bool negative = begin < end && *begin == '-';
+    if (negative)
+        begin++;
+    ok = begin < end;
+    int value = 0;
+    for (; begin < end; begin++)
+    {
+        if (*begin < '0' || *begin > '9')
+        {
+            ok = false;
+            return 0;
+        }
+        value = value * 10 + (*begin - '0');
+    }
+    return negative ? -value : value;
+}
+
+UserLog::UserLog(const QString &_baseFileName, int _compactThreshold) : baseFileName(_baseFileName), compactThreshold(_compactThreshold), logCount(0), compactThread(nullptr), baseMap(nullptr), baseData(nullptr), baseSize(0)
+{
+    QFileInfo info(baseFileName);
+    logFileName = info.path() + "/" + info.completeBaseName() + ".log";
+    compactingFileName = logFileName + ".compacting";
+}
+
+UserLog::~UserLog()
+{
+    waitForCompaction();
+    logFile.close();
+    if (baseMap)
+        baseFile.unmap(baseMap);
+    baseFile.close();
+}
+
+QString UserLog::formatRecord(const QString &username, const UserRecord &record)
+{
+    return username + " " + record.password + " " + QString::number(record.type) + " " + QString::number(record.balance) + " " + record.name + " " + record.phoneNumber + " " + record.address;
+}
+
+bool UserLog::parseBase(QHash<QString, UserRecord> &index, bool createIfMissing)
+{
+    baseFile.setFileName(baseFileName);
+    if (!baseFile.open(createIfMissing ? QIODevice::ReadWrite : QIODevice::ReadOnly))
+        return false;
+
+    baseSize = baseFile.size();
+    if (baseSize > 0)
+    {
+        baseMap = baseFile.map(0, baseSize);
+        if (baseMap)
+            baseData = reinterpret_cast<const char *>(baseMap);
+        else
+        {
+            qWarning() << "文件：用户文件映射失败，改为一次性读入" << baseFile.errorString();
+            baseBuffer = baseFile.readAll();
+            baseData = baseBuffer.constData();
+            baseSize = baseBuffer.size();
+        }
+    }
+
+    const char *begin = baseData, *end = baseData + baseSize;
+    index.reserve(index.size() + int(baseSize / 32));
+    for (const char *line = begin; line < end;)
+    {
+        const char *lineEnd = findDelimiter(line, end, '\n');
+        const char *next = lineEnd + 1;
+        if (lineEnd > line && lineEnd[-1] == '\r')
+            lineEnd--;
+
+        //只解码作为键的用户名，其余字段留到被访问时再解码
+        const char *usernameEnd = findDelimiter(line, lineEnd, ' ');
+        if (usernameEnd > line && usernameEnd < lineEnd)
+        {
+            UserRecord record;
+            record.rawOffset = line - begin;
+            record.rawLength = int(lineEnd - line);
+            index.insert(QString::fromLocal8Bit(line, int(usernameEnd - line)), record);
+        }
+        line = next;
+    }
+    return true;
+}
+
+UserRecord UserLog::resolve(const UserRecord &record) const
+{
+    if (!record.isRaw())
+        return record;
+
+    const char *begin = baseData + record.rawOffset, *end = begin + record.rawLength;
+    const char *fields[7];
+    int lengths[7];
+    int cnt = 0;
+    for (const char *p = begin; p < end && cnt < 7; cnt++)
+    {
+        const char *fieldEnd = cnt < 6 ? findDelimiter(p, end, ' ') : end;
+        fields[cnt] = p;
+        lengths[cnt] = int(fieldEnd - p);
+        p = fieldEnd + 1;
+    }
+
+    UserRecord result;
+    bool ok1 = false, ok2 = false;
+    if (cnt == 7)
+    {
+        result.type = parseInt(fields[2], fields[2] + lengths[2], ok1);
+        result.balance = parseInt(fields[3], fields[3] + lengths[3], ok2);
+    }
+    if (!ok1 || !ok2)
+    {
+        qWarning() << "文件：无法解析的用户记录" << QString::fromLocal8Bit(begin, record.rawLength);
+        result.type = -1;
+        result.balance = 0;
+        return result;
+    }
+    result.password = QString::fromLocal8Bit(fields[1], lengths[1]);
+    result.name = QString::fromLocal8Bit(fields[4], lengths[4]);
+    result.phoneNumber = QString::fromLocal8Bit(fields[5], lengths[5]);
+    result.address = QString::fromLocal8Bit(fields[6], lengths[6]);
+    return result;
+}
+
+void UserLog::materialize(UserRecord &record) const
+{
+    if (record.isRaw())
+        record = resolve(record);
+}
+
+void UserLog::releaseBase(QHash<QString, UserRecord> &index)
+{
+    if (!baseData)
+        return;
+    for (auto i = index.begin(); i != index.end(); i++)
+        materialize(i.value());
+    if (baseMap)
+        baseFile.unmap(baseMap);
+    baseFile.close();
+    baseMap = nullptr;
+    baseBuffer.clear();
+    baseData = nullptr;
+    baseSize = 0;
+}
+
+bool UserLog::load(QHash<QString, UserRecord> &index, bool openForAppend)
+{
+    if (!parseBase(index, openForAppend))
+        return false;
+    qDebug() << "文件：基文件载入" << index.size() << "个用户";
+
+    //先重放上次未完成压缩的旧日志，再重放当前日志
+    int compactingCount = replay(compactingFileName, index);
+    logCount = replay(logFileName, index);
+    qDebug() << "文件：重放用户日志" << compactingCount + logCount << "条";
+
+    //有未完成的压缩时，让下一次变更立即触发压缩
+    if (compactingCount > 0 || QFile::exists(compactingFileName))
+        logCount = qMax(logCount, compactThreshold);
+
+    if (openForAppend)
+        openLog();
+    return true;
+}
+
+void UserLog::resume(int count)
+{
+    logCount = count;
+    openLog();
+}
+
+int UserLog::count() const
+{
+    QMutexLocker locker(&logMutex);
+    return logCount;
+}
+
+QStringList UserLog::fileNames() const
+{
+    return {baseFileName, logFileName, compactingFileName};
+}
+
+int UserLog::replay(const QString &fileName, QHash<QString, UserRecord> &index)
+{
+    QFile file(fileName);
+    if (!file.exists() || !file.open(QIODevice::ReadOnly | QIODevice ::Text))
+        return 0;
+
+    QTextStream stream(&file);
+    QString line;
+    int cnt = 0;
+    bool ok1, ok2;
+    while (stream.readLineInto(&line))
+    {
+        QStringList fields = line.split(" ");
+        if (fields.size() == 8 && fields[0] == "U")
+        {
+            int type = fields[3].toInt(&ok1), balance = fields[4].toInt(&ok2);
+            if (!ok1 || !ok2)
+                continue;
+            index.insert(fields[1], UserRecord{fields[2], type, balance, fields[5], fields[6], fields[7]});
+        }
+        else if (fields.size() == 2 && fields[0] == "D")
+            index.remove(fields[1]);
+        else
+        {
+            //写到一半的尾部记录直接丢弃
+            qWarning() << "文件：忽略无法解析的用户日志" << line;
+            continue;
+        }
+        cnt++;
+    }
+    file.close();
+    return cnt;
+}
+
+void UserLog::openLog()
+{
+    logFile.setFileName(logFileName);
+    if (!logFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice ::Text))
+    {
+        qCritical() << "user日志文件打开失败";
+        exit(1);
+    }
+}
+
+bool UserLog::appendLines(const QStringList &lines)
+{
+    if (lines.isEmpty())
+        return true;
+    QMutexLocker locker(&logMutex);
+    if (!logFile.isOpen())
+    {
+        qCritical() << "文件：user日志未打开，无法追加";
+        return false;
+    }
+    qint64 oldSize = logFile.size();
+    QTextStream stream(&logFile);
+    stream << lines.join("\n") << Qt::endl;
+    if (stream.status() != QTextStream::Ok || !logFile.flush())
+    {
+        qCritical() << "文件：追加user日志失败" << logFile.errorString();
+        //截去写了一半的行，回滚后的变更不会在重放时出现
+        logFile.resize(oldSize);
+        return false;
+    }
+    logCount += lines.size();
+    return true;
+}
+
+bool UserLog::appendChanges(const QList<UserChange> &changes)
+{
+    QStringList lines;
+    lines.reserve(changes.size());
+    for (const UserChange &change : changes)
+        lines.append(change.deleted ? "D " + change.username : "U " + formatRecord(change.username, change.record));
+    return appendLines(lines);
+}
+
+bool UserLog::needsCompaction() const
+{
+    QMutexLocker locker(&logMutex);
+    return logCount >= compactThreshold;
+}
+
+void UserLog::compact(QHash<QString, UserRecord> &index, bool background)
+{
+    waitForCompaction();
+    releaseBase(index);
+
+    //轮换日志期间不允许写线程追加
+    QMutexLocker locker(&logMutex);
+    logFile.close();
+
+    QDir dir;
+    if (QFile::exists(compactingFileName))
+    {
+        //上一次压缩没有完成，index已包含两份日志的内容，同步写入即可；写入失败时两份日志都保留
+        if (!writeBase(baseFileName, compactingFileName, index))
+        {
+            openLog();
+            return;
+        }
+        dir.remove(logFileName);
+    }
+    else
+    {
+        dir.rename(logFileName, compactingFileName);
+        if (background)
+        {
+            //QHash是隐式共享的，这里的拷贝只增加引用计数
+            QHash<QString, UserRecord> snapshot = index;
+            QString base = baseFileName, compacting = compactingFileName;
+            compactThread = QThread::create([base, compacting, snapshot]()
+                                            { writeBase(base, compacting, snapshot); });
+            compactThread->start();
+        }
+        //写入失败时旧日志留在compactingFileName中，下次载入时重放，下次压缩时重试
+        else if (!writeBase(baseFileName, compactingFileName, index))
+            qWarning() << "文件：用户文件压缩失败，旧日志保留到下次压缩";
+    }
+
+    logCount = 0;
+    openLog();
+}
+
+void UserLog::waitForCompaction()
+{
+    if (compactThread)
+    {
+        compactThread->wait();
+        delete compactThread;
+        compactThread = nullptr;
+    }
+}
+
+bool UserLog::writeBase(const QString &baseFileName, const QString &compactingFileName, const QHash<QString, UserRecord> &index)
+{
+    //QSaveFile先写临时文件，commit时以rename整体替换基文件，任何时刻磁盘上都有完整的基文件
+    QSaveFile file(baseFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice ::Text))
+    {
+        qCritical() << "文件：用户文件压缩失败" << file.errorString();
+        return false;
+    }
+    QTextStream stream(&file);
+    for (auto i = index.constBegin(); i != index.constEnd(); i++)
+        stream << formatRecord(i.key(), i.value()) << Qt::endl;
+    stream.flush();
+    if (stream.status() != QTextStream::Ok || !file.commit())
+    {
+        qCritical() << "文件：用户文件压缩失败，保留旧日志" << file.errorString();
+        return false;
+    }
+
+    QDir dir;
+    dir.remove(compactingFileName);
+    qDebug() << "文件：用户文件压缩完成，共" << index.size() << "个用户";
+    return true;
+}